@@ -31,8 +31,15 @@
 #include "debug.h"
 #include "int.h"
 
+/*
+ * Objects are pushed and popped at the top. They can also be removed from
+ * the bottom, which leaves free space at the start of the memory that is
+ * reclaimed when the buffer needs more room.
+ */
+
 struct buf {
     char *a;   /* Memory. */
+    size_t h;  /* Index of the first used element. */
     size_t i;  /* Index of next unused element. */
     size_t n;  /* Number of elements allocated. */
     size_t es; /* Element size. */
@@ -74,37 +81,87 @@ error:
     debug(return NULL);
 }
 
+static void move_to_bottom(Buf b)
+{
+    /* Moves the used elements to the start of the memory. */
+    if (b->h) {
+        memmove(b->a, b->a + b->h * b->es, (b->i - b->h) * b->es);
+        b->i -= b->h;
+        b->h = 0;
+    }
+}
+
 int push(Buf b, void *object)
 {
     /* Assumes object is of size b->es. */
+    if (reserve_buf(b, 1))
+        debug(return 1);
+
+    memmove(b->a + b->i++ * b->es, object, b->es);
+
+    return 0;
+}
+
+int reserve_buf(Buf b, size_t n)
+{
+    /* Makes sure that n more objects can be pushed without failing. */
     size_t new_n;
     void *t;
 
-    if (b->i == b->n) {
-        /* Need to grow the buffer. */
-        if (mult_overflow(b->n, 2))
-            debug(return 1);
+    if (add_overflow(b->i, n))
+        debug(return 1);
 
-        new_n = b->n * 2;
+    if (b->i + n <= b->n)
+        return 0;
 
-        if (mult_overflow(new_n, b->es))
-            debug(return 1);
+    /*
+     * Reclaim the free space at the start when it is at least half of the
+     * memory, so that the cost of the move is spread over many pushes.
+     */
+    if (b->h >= b->n / 2) {
+        move_to_bottom(b);
+        if (b->i + n <= b->n)
+            return 0;
+    }
 
-        if ((t = realloc(b->a, new_n * b->es)) == NULL)
+    /* Need to grow the buffer. */
+    new_n = b->n;
+    do {
+        if (mult_overflow(new_n, 2))
             debug(return 1);
 
-        b->a = t;
-        b->n = new_n;
-    }
+        new_n *= 2;
+    } while (new_n < b->i - b->h + n);
 
-    memmove(b->a + b->i++ * b->es, object, b->es);
+    if (mult_overflow(new_n, b->es))
+        debug(return 1);
+
+    if ((t = realloc(b->a, new_n * b->es)) == NULL)
+        debug(return 1);
+
+    b->a = t;
+    b->n = new_n;
+
+    move_to_bottom(b);
+
+    return 0;
+}
+
+int push_n(Buf b, const void *objects, size_t n)
+{
+    /* Pushes n consecutive objects, each of size b->es. */
+    if (reserve_buf(b, n))
+        debug(return 1);
+
+    memmove(b->a + b->i * b->es, objects, n * b->es);
+    b->i += n;
 
     return 0;
 }
 
 int pop(Buf b, void *result)
 {
-    if (!b->i)
+    if (b->i == b->h)
         return 1; /* Only returns 1 when empty. */
 
     memmove(result, b->a + --b->i * b->es, b->es);
@@ -112,21 +169,86 @@ int pop(Buf b, void *result)
     return 0;
 }
 
+int pop_n(Buf b, void *result, size_t n)
+{
+    /*
+     * Pops the top n objects, keeping their original order.
+     * result can be NULL to simply discard the objects.
+     */
+    if (n > b->i - b->h)
+        return 1;
+
+    b->i -= n;
+
+    if (result != NULL)
+        memmove(result, b->a + b->i * b->es, n * b->es);
+
+    return 0;
+}
+
+int pop_bottom_n(Buf b, void *result, size_t n)
+{
+    /*
+     * Removes the bottom n objects, keeping their original order.
+     * result can be NULL to simply discard the objects.
+     */
+    if (n > b->i - b->h)
+        return 1;
+
+    if (result != NULL)
+        memmove(result, b->a + b->h * b->es, n * b->es);
+
+    b->h += n;
+
+    if (b->h == b->i) {
+        b->h = 0;
+        b->i = 0;
+    }
+
+    return 0;
+}
+
 void truncate_buf(Buf b)
 {
+    b->h = 0;
     b->i = 0;
 }
 
+void shrink_buf(Buf b)
+{
+    /*
+     * Halves the allocation while no more than a quarter of it is used.
+     * If the reallocation fails, then the buffer keeps its current memory.
+     */
+    size_t new_n;
+    void *t;
+
+    move_to_bottom(b);
+
+    new_n = b->n;
+    while (new_n > 1 && b->i <= new_n / 4)
+        new_n /= 2;
+
+    if (new_n == b->n)
+        return;
+
+    if ((t = realloc(b->a, new_n * b->es)) == NULL)
+        return;
+
+    b->a = t;
+    b->n = new_n;
+}
+
 void *get_buf_element(Buf b, size_t element)
 {
     /* Pointer can change after reallocation, so not safe to use after push. */
-    if (element >= b->i)
+    if (element >= b->i - b->h)
         debug(return NULL); /* Out of bounds. */
 
-    return b->a + element * b->es;
+    return b->a + (b->h + element) * b->es;
 }
 
 size_t buf_num_used_elements(Buf b)
 {
-    return b->i;
+    return b->i - b->h;
 }
@@ -37,10 +37,20 @@ Buf init_buf(size_t init_num_elements, size_t element_size);
 
 int push(Buf b, void *object);
 
+int reserve_buf(Buf b, size_t n);
+
+int push_n(Buf b, const void *objects, size_t n);
+
 int pop(Buf b, void *result);
 
+int pop_n(Buf b, void *result, size_t n);
+
+int pop_bottom_n(Buf b, void *result, size_t n);
+
 void truncate_buf(Buf b);
 
+void shrink_buf(Buf b);
+
 void *get_buf_element(Buf b, size_t element);
 
 size_t buf_num_used_elements(Buf b);
@@ -200,13 +200,18 @@ done < "$tmp"
 "$cc" $c_ops test_buf.o buf.o int.o -o test/test_buf
 "$cc" $c_ops test_input.o input.o buf.o int.o -o test/test_input
 "$cc" $c_ops test_screen.o screen.o int.o -o test/test_screen
-"$cc" $c_ops test_gap_buf.o gap_buf.o memmem.o screen.o input.o buf.o int.o \
-    -o test/test_gap_buf
+"$cc" $c_ops test_gap_buf.o gap_buf.o memmem.o regex.o screen.o input.o buf.o \
+    int.o -o test/test_gap_buf
+
+"$cc" $c_ops test_regex.o regex.o memmem.o int.o -o test/test_regex
+
+"$cc" $c_ops test_memmem.o memmem.o -o test/test_memmem
 
 "$cc" $c_ops test_dll.o doubly_linked_list.o \
     -o test/test_dll
 
-"$cc" $c_ops suco.o gap_buf.o memmem.o screen.o input.o buf.o int.o -o suco
+"$cc" $c_ops suco.o gap_buf.o memmem.o regex.o screen.o input.o buf.o int.o \
+    -o suco
 
 
 # Move source code back.
@@ -231,10 +236,13 @@ cd "$build_dir" || exit 1
 
 # Move executables.
 valgrind ./test/test_buf
+./test/test_memmem
 # valgrind ./test/test_input
 mv test/test_buf "$wd"/test/test_buf
 mv test/test_input "$wd"/test/test_input
 mv test/test_screen "$wd"/test/test_screen
 mv test/test_gap_buf "$wd"/test/test_gap_buf
+mv test/test_regex "$wd"/test/test_regex
+mv test/test_memmem "$wd"/test/test_memmem
 mv test/test_dll "$wd"/test/test_dll
 mv suco "$wd"/suco
@@ -27,7 +27,21 @@
 #define _DEFAULT_SOURCE
 #endif
 
+/* For mremap. */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,9 +50,9 @@
 #include "buf.h"
 #include "debug.h"
 #include "gap_buf.h"
-#include "input.h"
 #include "int.h"
 #include "memmem.h"
+#include "regex.h"
 
 /* Copy type. */
 #define COPY_REGION 0
@@ -55,11 +69,55 @@
 #define UNDO   2
 #define REDO   4
 
+/*
+ * Merging a backwards deletion moves the text of the operation, so the
+ * length of these merged operations is limited.
+ */
+#define MAX_BACKWARDS_MERGE 256
+
+/*
+ * Checkpoints: A copy of the text is taken when a change leaves the save step,
+ * and every CHECKPOINT_STEPS steps, so that reverting can restore it instead
+ * of undoing each step. At most MAX_CHECKPOINTS are kept.
+ */
+#define CHECKPOINT_STEPS 1000
+#define MAX_CHECKPOINTS  4
+
+/*
+ * Gap growth: Small buffers double. Once a buffer is larger than
+ * BIG_GROWTH_THRESHOLD, it grows by 1/BIG_GROWTH_DIVISOR of its size, so that
+ * a multi-gigabyte buffer does not need twice its size in memory.
+ */
+#define BIG_GROWTH_THRESHOLD (64UL * 1024 * 1024)
+#define BIG_GROWTH_DIVISOR   4
+
+/*
+ * Gap shrinking: When the gap is more than 3/4 of the memory after a deletion,
+ * the memory is reduced to twice the size of the text, so that growing and
+ * shrinking do not alternate. Memory is not reduced below SHRINK_MIN_SIZE.
+ */
+#define SHRINK_MIN_SIZE 4096
+
+/*
+ * On Linux, once a buffer grows past BIG_GROWTH_THRESHOLD, its memory is moved
+ * into a reservation of RESERVE_FACTOR times its size. Pages are committed as
+ * the gap grows, so the text before the gap is not copied again.
+ */
+#define RESERVE_FACTOR 4
+
+/* Number of characters in a block of the brace index. */
+#define BRACE_BLOCK 4096
+
+/* Brace types: (), [], {} and <>. */
+#define NUM_BRACE_TYPES 4
+
 /*
  * When undoing, the undo buffer is used to replay (the opposite)
  * of operations. But when redoing, the redo buffer is used to replay.
  */
 #define replay_buf(gb) ((gb)->mode == UNDO ? (gb)->undo : (gb)->redo)
+#define replay_text(gb)                                                       \
+    ((gb)->mode == UNDO ? (gb)->undo_text : (gb)->redo_text)
 
 /*
  * Normally operations are recorded in the undo buffer,
@@ -67,6 +125,8 @@
  * But, when undoing, the operations are recorded in the redo buffer.
  */
 #define record_buf(gb) ((gb)->mode == UNDO ? (gb)->redo : (gb)->undo)
+#define record_text(gb)                                                       \
+    ((gb)->mode == UNDO ? (gb)->redo_text : (gb)->undo_text)
 
 #define clear_mark(gb)                                                        \
     do {                                                                      \
@@ -80,11 +140,104 @@
         (gb)->sc = 0;                                                         \
     } while (0)
 
+/*
+ * An operation applies to a span of n characters starting at g.
+ * The text of a deletion is stored in the text buffer that is paired
+ * with the operation buffer, with the most recent text on top.
+ * An insertion does not need to store its text, as the text is still
+ * in the gap buffer when the insertion is undone.
+ *
+ * Single character insertions and deletions that are next to the previous
+ * one are merged into it, so that a typed word is one operation. A word
+ * starts when a non-whitespace character follows a whitespace character.
+ */
 struct operation {
     /* Copy of the g location. g does not change with realloc. */
     size_t g;
+    size_t n;           /* Number of characters. */
     unsigned char type; /* Type of operation. */
-    char ch;            /* The inserted or deleted character. */
+};
+
+/*
+ * A branch keeps a redo history that would otherwise be lost when a new
+ * change is made after undoing. Together, the branches form an undo tree.
+ * A branch starts from a step of the current history. Branches that start
+ * within a branch are nested inside of it. Switching branches swaps the
+ * buffers, so the operations are never copied.
+ */
+struct branch {
+    size_t step;   /* The step that the branch starts from. */
+    Buf ops;       /* Redo buffer of the branch. */
+    Buf text;      /* Redo text buffer of the branch. */
+    Buf nested;    /* Branches that start within this branch. */
+    size_t save;   /* Save step, if the last save is in this branch. */
+    size_t save_n; /* Identifies the save. */
+    int save_set;  /* Indicates that the save is in this branch. */
+};
+
+/*
+ * A checkpoint is a copy of the text at a step of the current history. It is
+ * dropped when that step leaves the current history.
+ */
+struct checkpoint {
+    size_t step; /* The step that the text is from. */
+    char *text;  /* Copy of the text. */
+    size_t n;    /* Length of the text. */
+};
+
+/*
+ * State of a trim and clean. The text is scanned backwards, as whether a
+ * character is deleted depends on what follows it.
+ */
+struct trim {
+    int at_end_of_buffer; /* Only whitespace follows. */
+    int delete_nl;        /* The final newline character has been kept. */
+    int at_end_of_line;   /* Only spaces and tabs follow, up to a newline. */
+    int apply;            /* Make the changes, instead of only counting. */
+    size_t num;           /* Number of characters deleted. */
+    size_t num_after;     /* Number of characters deleted after the gap. */
+    size_t runs;          /* Number of runs of deleted characters. */
+    size_t d;             /* Index where the next kept character goes. */
+};
+
+/*
+ * A row of the screen, when printing from the draw start. g is the first
+ * character that is printed on the row, and k is the number of its screen
+ * positions that were printed on the rows above, as a long character, like
+ * a tab, can wrap. Every row starts at the left-hand side.
+ */
+struct row {
+    size_t g;
+    size_t k;
+};
+
+/*
+ * A print of the text area of a sub-screen. The highlighted text is from hs
+ * (inclusive) to he (exclusive).
+ */
+struct print {
+    Screen sc;
+    size_t y;   /* Origin of the text area. */
+    size_t x;
+    size_t h;   /* Size of the text area. */
+    size_t w;
+    size_t len; /* Length of the text. */
+    size_t hs;  /* Start of the highlighted text. */
+    size_t he;  /* End of the highlighted text. */
+};
+
+/*
+ * The brace index splits the memory into blocks of BRACE_BLOCK characters,
+ * with a segment tree over the blocks. Node 1 is the root, and the children of
+ * node k are nodes 2k and 2k + 1. For each brace type, a node records the
+ * change in depth over its text, and the lowest depth reached, going forwards
+ * from a depth of zero. Going backwards, the highest depth reached is delta
+ * less low. The gap is not part of the text. Blocks are brought up to date
+ * when the index is used, so that moving the gap only marks them.
+ */
+struct brace_node {
+    long delta[NUM_BRACE_TYPES]; /* Opening less closing braces. */
+    long low[NUM_BRACE_TYPES];   /* Lowest depth. Zero or less. */
 };
 
 /*
@@ -94,64 +247,261 @@ struct operation {
  * The start is always inclusive and the end is always exclusive.
  */
 
+/*
+ * The line index mirrors the gap. The newline characters before the gap are
+ * recorded by their g-value, with the closest to the gap on top.
+ * The newline characters after the gap are recorded by their distance
+ * from e, again with the closest to the gap on top. Neither changes when
+ * characters are inserted or deleted at the gap, or when the memory is
+ * reallocated.
+ */
+
 struct gap_buf {
-    char *fn;    /* Filename associated with the gap buffer. */
-    Buf undo;    /* Undo stack. */
-    Buf redo;    /* Redo stack. */
-    int mode;    /* Mode: NORMAL, UNDO, REDO. */
-    char *a;     /* Memory. */
-    size_t g;    /* Start of gap. */
-    size_t c;    /* Cursor. */
-    size_t e;    /* End of gap buffer (included in memory). */
-    size_t m;    /* Mark. This is a saved "g-value." */
-    int m_set;   /* Indicates that the mark is set. */
-    size_t row;  /* Cursor row. Starts from 1. */
-    size_t col;  /* Cursor column. Starts from 0. */
-    size_t sc;   /* Sticky column. Used for repeared up or down. */
-    int sc_set;  /* Indicates that the sticky column is set. */
-    size_t d;    /* Draw start. This can be compared with g. */
-    int rc;      /* Request centring. */
-    size_t mod;  /* Modified indicator. */
-    char *sb;    /* Status bar. */
-    size_t sb_s; /* Status bar allocated size. */
+    char *fn;      /* Filename associated with the gap buffer. */
+    Buf undo;      /* Undo stack. */
+    Buf undo_text; /* Text of the deletions in the undo stack. */
+    Buf redo;      /* Redo stack. */
+    Buf redo_text; /* Text of the deletions in the redo stack. */
+    int mode;      /* Mode: NORMAL, UNDO, REDO. */
+    int merge;     /* Indicates that the last operation can be extended. */
+    size_t undo_l; /* Undo memory limit in bytes. Zero for no limit. */
+    size_t depth;  /* Depth of the groups being recorded in normal mode. */
+    size_t step;   /* Number of undo steps that make up the text. */
+    size_t save;   /* The step at the last save. */
+    size_t save_n; /* Number of saves. Identifies the last save. */
+    int save_set;  /* Indicates that the save step can be reached. */
+    Buf branches;  /* Branches that start from the current history. */
+    size_t br_s;   /* Memory used by the branches, in bytes. */
+    Buf cps;       /* Checkpoints of the current history, oldest first. */
+    size_t cp_s;   /* Memory used by the checkpoints, in bytes. */
+    char *a;       /* Memory. */
+    size_t map_s;  /* Size of the mapping, or zero if a is from malloc. */
+    size_t res_s;  /* Size of the reservation that starts with the mapping. */
+    size_t g;      /* Start of gap. */
+    size_t c;      /* Cursor. */
+    size_t e;      /* End of gap buffer (included in memory). */
+    size_t m;      /* Mark. This is a saved "g-value." */
+    int m_set;     /* Indicates that the mark is set. */
+    Buf nl_before; /* Line index before the gap. */
+    Buf nl_after;  /* Line index after the gap. */
+    size_t sc;     /* Sticky column. Used for repeared up or down. */
+    int sc_set;    /* Indicates that the sticky column is set. */
+    size_t d;      /* Draw start. This can be compared with g. */
+    int rc;        /* Request centring. */
+    Buf rows;      /* Cache of the rows on the screen, starting from d. */
+    size_t rows_h; /* Height of the text area that the rows are for. */
+    size_t rows_w; /* Width of the text area that the rows are for. */
+    /*
+     * Damage tracking: The text that has changed since the last print is
+     * tracked as one span, from dmg_s to dmg_e. At the last print, the span
+     * ended at dmg_oe instead. The text outside of the span is unchanged, so
+     * the rows that only show it do not need to be printed again.
+     */
+    struct print last; /* The last print. sc is NULL to print every row. */
+    Buf last_rows;     /* Rows of the last print. */
+    Buf last_stamps;   /* Screen row stamps left by the last print. */
+    int dmg;           /* Indicates that the text has changed. */
+    size_t dmg_s;      /* Start of the changed text. */
+    size_t dmg_e;      /* End of the changed text. */
+    size_t dmg_oe;     /* End of the changed text, at the last print. */
+    struct brace_node *bi;   /* Brace index. */
+    size_t bi_n;             /* Number of blocks in the index. Power of 2. */
+    unsigned char *bi_dirty; /* Indicates that a block is out of date. */
+    Buf bi_list;             /* The blocks that are out of date. */
+    int bi_stale;            /* Indicates that every block is out of date. */
+    size_t mod;    /* Modified indicator. Clear at the save step. */
+    char *sb;      /* Status bar. */
+    size_t sb_s;   /* Status bar allocated size. */
 };
 
 /* ######################################################################## */
 /* ################ Initialise, reset and free functions  ################# */
 /* ######################################################################## */
 
+static void free_mem(Gap_buf gb)
+{
+#ifdef __linux__
+    if (gb->map_s) {
+        munmap(gb->a, gb->res_s);
+        gb->map_s = 0;
+        gb->res_s = 0;
+        return;
+    }
+#endif
+    free(gb->a);
+}
+
+static void free_branch(struct branch *b)
+{
+    size_t i;
+
+    if (b != NULL) {
+        if (b->nested != NULL)
+            for (i = 0; i < buf_num_used_elements(b->nested); ++i)
+                free_branch(*(struct branch **) get_buf_element(b->nested, i));
+
+        free_buf(b->ops);
+        free_buf(b->text);
+        free_buf(b->nested);
+        free(b);
+    }
+}
+
+static void free_branches(Gap_buf gb)
+{
+    size_t i;
+
+    for (i = 0; i < buf_num_used_elements(gb->branches); ++i)
+        free_branch(*(struct branch **) get_buf_element(gb->branches, i));
+
+    truncate_buf(gb->branches);
+    gb->br_s = 0;
+}
+
+static void free_checkpoints(Gap_buf gb)
+{
+    size_t i;
+
+    for (i = 0; i < buf_num_used_elements(gb->cps); ++i)
+        free(((struct checkpoint *) get_buf_element(gb->cps, i))->text);
+
+    truncate_buf(gb->cps);
+    gb->cp_s = 0;
+}
+
 void gb_free(Gap_buf gb)
 {
     if (gb != NULL) {
         free(gb->fn);
         free_buf(gb->undo);
+        free_buf(gb->undo_text);
         free_buf(gb->redo);
-        free(gb->a);
+        free_buf(gb->redo_text);
+        if (gb->branches != NULL)
+            free_branches(gb);
+
+        free_buf(gb->branches);
+        if (gb->cps != NULL)
+            free_checkpoints(gb);
+
+        free_buf(gb->cps);
+        free_mem(gb);
+        free_buf(gb->nl_before);
+        free_buf(gb->nl_after);
+        free_buf(gb->rows);
+        free_buf(gb->last_rows);
+        free_buf(gb->last_stamps);
+        free(gb->bi);
+        free(gb->bi_dirty);
+        free_buf(gb->bi_list);
         free(gb->sb);
         free(gb);
     }
 }
 
+static void shrink_gap(Gap_buf gb, int force)
+{
+    /*
+     * Gives back memory when the gap is more than 3/4 of it, or more than half
+     * of it when forced. If the reallocation fails, then the buffer keeps its
+     * current memory.
+     */
+    size_t s, gap, new_s;
+    char *t;
+
+    s = gb->e + 1;
+    gap = gb->c - gb->g;
+
+    if (s <= SHRINK_MIN_SIZE || gap <= (force ? s / 2 : s / 4 * 3))
+        return;
+
+    new_s = (s - gap) * 2; /* Cannot overflow, as less than s. */
+    if (new_s < SHRINK_MIN_SIZE)
+        new_s = SHRINK_MIN_SIZE;
+
+    if (gb->map_s) {
+        /*
+         * A mapping is not moved. Instead, the whole pages in the gap are
+         * released, as their content does not matter.
+         */
+#if defined(__linux__) && defined(MADV_DONTNEED)
+        long page;
+        size_t start, end;
+
+        if (!force || (page = sysconf(_SC_PAGESIZE)) <= 0)
+            return;
+
+        start = (gb->g + (size_t) page - 1) / (size_t) page * (size_t) page;
+        end = gb->c / (size_t) page * (size_t) page;
+        if (start < end)
+            madvise(gb->a + start, end - start, MADV_DONTNEED);
+#endif
+        return;
+    }
+
+    /* Move up data after the gap. */
+    memmove(gb->a + gb->c - (s - new_s), gb->a + gb->c, gb->e - gb->c + 1);
+
+    /* Update values that are after the gap. */
+    gb->c -= s - new_s;
+    gb->e -= s - new_s;
+    gb->bi_stale = 1;
+
+    if ((t = realloc(gb->a, new_s)) != NULL)
+        gb->a = t;
+}
+
+void gb_compact(Gap_buf gb)
+{
+    /*
+     * Gives back unused memory. Suitable for when the buffer is not in use,
+     * such as when it is switched away from.
+     */
+    shrink_gap(gb, 1);
+    shrink_buf(gb->undo);
+    shrink_buf(gb->undo_text);
+    shrink_buf(gb->redo);
+    shrink_buf(gb->redo_text);
+    shrink_buf(gb->branches);
+    shrink_buf(gb->cps);
+    shrink_buf(gb->nl_before);
+    shrink_buf(gb->nl_after);
+}
+
 void gb_reset(Gap_buf gb)
 {
     /*
-     * Resets a buffer without freeing memmory allocations.
+     * Resets a buffer, giving back most of its memory.
      * The buffer name is preserved. History is lost and the buffer
      * is marked as modified.
      */
     truncate_buf(gb->undo);
+    truncate_buf(gb->undo_text);
     truncate_buf(gb->redo);
+    truncate_buf(gb->redo_text);
     gb->mode = NORMAL;
+    gb->merge = 0;
+    gb->depth = 0;
+    gb->step = 0;
+    gb->save_set = 0;
+    free_branches(gb);
+    free_checkpoints(gb);
     gb->g = 0;
     gb->c = gb->e;
     clear_mark(gb);
-    gb->row = 1;
-    gb->col = 0;
+    truncate_buf(gb->nl_before);
+    truncate_buf(gb->nl_after);
     gb->d = 0;
     gb->rc = 0;
+    truncate_buf(gb->rows);
+    gb->last.sc = NULL;
+    gb->dmg = 0;
+    gb->bi_stale = 1;
     gb->mod = 1;
     if (gb->sb != NULL)
         *gb->sb = '\0';
+
+    gb_compact(gb);
 }
 
 Gap_buf gb_init(size_t init_num_elements)
@@ -167,18 +517,45 @@ Gap_buf gb_init(size_t init_num_elements)
     /* Do not assume that NULL is zero. */
     gb->fn = NULL;
     gb->undo = NULL;
+    gb->undo_text = NULL;
     gb->redo = NULL;
+    gb->redo_text = NULL;
+    gb->branches = NULL;
+    gb->cps = NULL;
     gb->a = NULL;
+    gb->nl_before = NULL;
+    gb->nl_after = NULL;
+    gb->rows = NULL;
+    gb->last.sc = NULL;
+    gb->last_rows = NULL;
+    gb->last_stamps = NULL;
+    gb->bi = NULL;
+    gb->bi_dirty = NULL;
+    gb->bi_list = NULL;
     gb->sb = NULL;
 
     if ((gb->undo = init_buf(init_num_elements, sizeof(struct operation)))
         == NULL)
         debug(goto error);
 
+    if ((gb->undo_text = init_buf(init_num_elements, sizeof(char))) == NULL)
+        debug(goto error);
+
     if ((gb->redo = init_buf(init_num_elements, sizeof(struct operation)))
         == NULL)
         debug(goto error);
 
+    if ((gb->redo_text = init_buf(init_num_elements, sizeof(char))) == NULL)
+        debug(goto error);
+
+    if ((gb->branches = init_buf(init_num_elements, sizeof(struct branch *)))
+        == NULL)
+        debug(goto error);
+
+    if ((gb->cps = init_buf(MAX_CHECKPOINTS, sizeof(struct checkpoint)))
+        == NULL)
+        debug(goto error);
+
     gb->mode = NORMAL;
 
     if ((gb->a = calloc(init_num_elements, sizeof(char))) == NULL)
@@ -187,7 +564,29 @@ Gap_buf gb_init(size_t init_num_elements)
     gb->c = init_num_elements - 1;
     gb->e = init_num_elements - 1;
     *(gb->a + gb->e) = '~'; /* The end of buffer character. */
-    gb->row = 1;
+
+    if ((gb->nl_before = init_buf(init_num_elements, sizeof(size_t))) == NULL)
+        debug(goto error);
+
+    if ((gb->nl_after = init_buf(init_num_elements, sizeof(size_t))) == NULL)
+        debug(goto error);
+
+    if ((gb->rows = init_buf(init_num_elements, sizeof(struct row))) == NULL)
+        debug(goto error);
+
+    if ((gb->last_rows = init_buf(init_num_elements, sizeof(struct row)))
+        == NULL)
+        debug(goto error);
+
+    if ((gb->last_stamps = init_buf(init_num_elements, sizeof(size_t)))
+        == NULL)
+        debug(goto error);
+
+    if ((gb->bi_list = init_buf(init_num_elements, sizeof(size_t))) == NULL)
+        debug(goto error);
+
+    /* The index is built when it is first used. */
+    gb->bi_stale = 1;
 
     return gb;
 
@@ -202,234 +601,1049 @@ error:
 /* ############### Fundamental operations on the gap buffer ############### */
 /* ######################################################################## */
 
-int gb_insert_ch(Gap_buf gb, char ch)
+static size_t count_nl(const char *mem, size_t n, const char **last_nl)
 {
     /*
-     * The character is written at g, then g is incremented.
-     *
-     * Before:
-     * woXXXXld~
-     * ^ ^   ^ ^
-     * | |   | |
-     * a g   c e
-     *
-     * After:
-     * worXXXld~
-     * ^  ^  ^ ^
-     * |  |  | |
-     * a  g  c e
-     *
+     * Counts the newline characters in a span of memory. If there are any,
+     * then last_nl is set to point to the last one.
      */
+    const char *p, *q, *end;
+    size_t count = 0;
+
+    p = mem;
+    end = mem + n;
+    while (p < end && (q = memchr(p, '\n', end - p)) != NULL) {
+        ++count;
+        *last_nl = q;
+        p = q + 1;
+    }
 
-    size_t s;
-    char *t;
-    struct operation op;
-
-    clear_sticky_column(gb);
+    return count;
+}
 
-    if (gb->g == gb->c) {
-        /* Need to grow the gap. */
-        s = gb->e + 1; /* Cannot overflow, as already in memory. */
-        if (mult_overflow(s, 2))
-            debug(return 1);
+static size_t nl_after_g(Gap_buf gb, size_t j)
+{
+    /* Returns the g-value of the j-th newline after the gap (from 0). */
+    size_t *d;
 
-        if ((t = realloc(gb->a, s * 2)) == NULL)
-            debug(return 1);
+    d = get_buf_element(
+        gb->nl_after, buf_num_used_elements(gb->nl_after) - 1 - j);
+    return gb->g + (gb->e - *d - gb->c);
+}
 
-        gb->a = t;
+static size_t line_start(Gap_buf gb)
+{
+    /* Returns the g-value of the start of the cursor line. */
+    size_t n;
 
-        /* Move down data after the gap. */
-        memmove(gb->a + gb->c + s, gb->a + gb->c, gb->e - gb->c + 1);
+    if (!(n = buf_num_used_elements(gb->nl_before)))
+        return 0;
 
-        /* Update values that are after the gap. */
-        gb->c += s;
-        gb->e += s;
-    }
+    return *(size_t *) get_buf_element(gb->nl_before, n - 1) + 1;
+}
 
-    /* Record the operation. */
-    op.g = gb->g; /* Record g before it changes. */
-    op.type = INSERT;
-    op.ch = ch;
+static size_t cursor_row(Gap_buf gb)
+{
+    /* Starts from 1. */
+    return buf_num_used_elements(gb->nl_before) + 1;
+}
 
-    if (push(record_buf(gb), &op))
-        debug(return 1);
+static size_t cursor_col(Gap_buf gb)
+{
+    /* Starts from 0. */
+    return gb->g - line_start(gb);
+}
 
-    /* Cannot fail now. */
+static void drop_rows(Gap_buf gb, size_t g)
+{
+    /*
+     * Drops the cached rows that a change at g can move. The rows that start
+     * before g, or with the character at g, are printed the same way.
+     */
+    struct row *row;
+    size_t n;
 
-    /* Need to truncate the redo buffer when in normal mode. */
-    if (gb->mode == NORMAL)
-        truncate_buf(gb->redo);
+    while ((n = buf_num_used_elements(gb->rows))) {
+        row = get_buf_element(gb->rows, n - 1);
+        if (row->g < g || (row->g == g && !row->k))
+            break;
 
-    /* Write character to the left of the gap, making the gap smaller. */
-    *(gb->a + gb->g++) = ch;
+        pop_n(gb->rows, NULL, 1);
+    }
+}
 
-    /* Update row number and column number. */
-    if (ch == '\n') {
-        ++gb->row;
-        gb->col = 0;
-    } else {
-        ++gb->col;
+static void damage(Gap_buf gb, size_t ins, size_t del)
+{
+    /*
+     * Records that del characters at the cursor have been replaced by ins
+     * characters. The span of changed text grows to cover them.
+     */
+    if (!gb->dmg) {
+        gb->dmg = 1;
+        gb->dmg_s = gb->g;
+        gb->dmg_e = gb->g;
+        gb->dmg_oe = gb->g;
     }
 
-    clear_mark(gb);
+    if (gb->g < gb->dmg_s)
+        gb->dmg_s = gb->g;
 
-    /* Set the modified indicator. */
-    gb->mod = 1;
+    /* The text between the span and the change was the same at the print. */
+    if (gb->g + del > gb->dmg_e) {
+        gb->dmg_oe += gb->g + del - gb->dmg_e;
+        gb->dmg_e = gb->g + del;
+    }
 
-    return 0;
+    gb->dmg_e = gb->dmg_e - del + ins;
 }
 
-int gb_delete_ch(Gap_buf gb)
+static void touch_braces(Gap_buf gb, size_t s, size_t n)
 {
     /*
-     * c is incremented.
-     *
-     * Before:
-     * elepXXXXjhant~
-     * ^   ^   ^    ^
-     * |   |   |    |
-     * a   g   c    e
-     *
-     * After:
-     * elepXXXXXhant~
-     * ^   ^    ^   ^
-     * |   |    |   |
-     * a   g    c   e
-     *
-     * Not displaying the gap:
-     * Before:
-     * elepjhant~
-     *     ^
-     *     |
-     *     c
-     *
-     * After:
-     * elephant~
-     *     ^
-     *     |
-     *     c
-     *
+     * Marks the blocks of the brace index that hold the memory from s to
+     * s + n as out of date, as characters have moved in or out of the gap.
      */
+    size_t i;
 
-    struct operation op;
-
-    clear_sticky_column(gb);
+    if (gb->bi_stale || !n)
+        return;
 
-    /* Cannot delete the last character in the gap buffer. */
-    if (gb->c == gb->e)
-        return 1;
+    for (i = s / BRACE_BLOCK; i <= (s + n - 1) / BRACE_BLOCK; ++i)
+        if (!gb->bi_dirty[i]) {
+            if (push(gb->bi_list, &i)) {
+                gb->bi_stale = 1; /* Rebuild instead. */
+                return;
+            }
 
-    op.g = gb->g;
-    op.type = DELETE;
-    op.ch = *(gb->a + gb->c);
+            gb->bi_dirty[i] = 1;
+        }
+}
 
-    /* Record the operation. */
-    if (push(record_buf(gb), &op))
-        debug(return 1);
+#ifdef __linux__
+static int extend_map(Gap_buf gb, size_t new_s)
+{
+    /*
+     * Extends the mapping to new_s by committing reserved pages, or by
+     * remapping, which moves pages instead of copying them.
+     */
+    char *p;
 
-    /* Cannot fail now. */
+    if (new_s <= gb->res_s) {
+        if (mprotect(gb->a + gb->map_s, new_s - gb->map_s,
+                PROT_READ | PROT_WRITE))
+            return 1;
+    } else {
+        /* The reservation is used up. */
+        if (gb->res_s > gb->map_s
+            && !munmap(gb->a + gb->map_s, gb->res_s - gb->map_s))
+            gb->res_s = gb->map_s;
 
-    /* Need to truncate the redo buffer when in normal mode. */
-    if (gb->mode == NORMAL)
-        truncate_buf(gb->redo);
+        if (gb->res_s > gb->map_s)
+            return 1;
 
-    /* Expand the gap to the right. */
-    ++gb->c;
+        if ((p = mremap(gb->a, gb->map_s, new_s, MREMAP_MAYMOVE))
+            == MAP_FAILED)
+            return 1;
 
-    clear_mark(gb);
+        gb->a = p;
+        gb->res_s = new_s;
+    }
 
-    gb->mod = 1;
+    gb->map_s = new_s;
 
     return 0;
 }
 
-int gb_left_ch(Gap_buf gb)
+static int grow_map(Gap_buf gb, size_t new_s)
 {
     /*
-     * g and c are decremented, then the character at g is copied to c.
-     *
-     * Before:
-     * worXXXXld~
-     * ^  ^   ^ ^
-     * |  |   | |
-     * a  g   c e
-     *
-     * Decrement:
-     * worXXXXld~
-     * ^ ^   ^  ^
-     * | |   |  |
-     * a g   c  e
-     *
-     * After:
-     * woXXXXrld~
-     * ^ ^   ^  ^
-     * | |   |  |
-     * a g   c  e
-     *
+     * Grows the memory to at least new_s without copying the text before the
+     * gap. A buffer that is on the heap, or whose mapping cannot be extended,
+     * is copied into a new reservation. Returns 1 if the memory was not grown,
+     * in which case the buffer is unchanged.
      */
+    long page;
+    size_t s, res_s;
+    char *p;
+
+    if (!gb->map_s && new_s <= BIG_GROWTH_THRESHOLD)
+        return 1;
+
+    if ((page = sysconf(_SC_PAGESIZE)) <= 0
+        || add_overflow(new_s, (size_t) page - 1))
+        return 1;
+
+    new_s = (new_s + (size_t) page - 1) / (size_t) page * (size_t) page;
+    s = gb->e + 1;
+
+    if (gb->map_s && !extend_map(gb, new_s)) {
+        /* Move down data after the gap. */
+        memmove(gb->a + gb->c + new_s - s, gb->a + gb->c, gb->e - gb->c + 1);
+    } else {
+        res_s = new_s;
+        if (!mult_overflow(new_s, RESERVE_FACTOR))
+            res_s = new_s * RESERVE_FACTOR;
+
+        p = mmap(NULL, res_s, PROT_NONE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED)
+            return 1;
+
+        if (mprotect(p, new_s, PROT_READ | PROT_WRITE)) {
+            munmap(p, res_s);
+            return 1;
+        }
+
+#ifdef MADV_HUGEPAGE
+        madvise(p, res_s, MADV_HUGEPAGE);
+#endif
+
+        memcpy(p, gb->a, gb->g);
+        memcpy(p + gb->c + new_s - s, gb->a + gb->c, gb->e - gb->c + 1);
+        free_mem(gb);
+        gb->a = p;
+        gb->map_s = new_s;
+        gb->res_s = res_s;
+    }
+
+    /* Update values that are after the gap. */
+    gb->c += new_s - s;
+    gb->e += new_s - s;
+    gb->bi_stale = 1;
+
+    return 0;
+}
+#endif
+
+static int grow_gap(Gap_buf gb, size_t n)
+{
+    /* Makes sure that the gap can hold at least n characters. */
+    size_t s, new_s;
+    char *t;
+
+    if (gb->c - gb->g >= n)
+        return 0;
+
+    s = gb->e + 1; /* Cannot overflow, as already in memory. */
+    if (add_overflow(s, n))
+        debug(return 1);
+
+    if (s <= BIG_GROWTH_THRESHOLD)
+        new_s = s * 2; /* Cannot overflow, as the threshold is small. */
+    else if (add_overflow(s, s / BIG_GROWTH_DIVISOR))
+        new_s = s + n;
+    else
+        new_s = s + s / BIG_GROWTH_DIVISOR;
+
+    if (new_s < s + n)
+        new_s = s + n;
+
+#ifdef __linux__
+    if (!grow_map(gb, new_s))
+        return 0;
+#endif
+
+    if (gb->map_s) {
+        /*
+         * A mapping cannot be reallocated, so the text is copied to the heap.
+         * This only happens once the reserved gap has been used up.
+         */
+        if ((t = malloc(new_s)) == NULL)
+            debug(return 1);
+
+        memcpy(t, gb->a, gb->g);
+        memcpy(t + gb->c + new_s - s, gb->a + gb->c, gb->e - gb->c + 1);
+        free_mem(gb);
+        gb->a = t;
+    } else {
+        if ((t = realloc(gb->a, new_s)) == NULL)
+            debug(return 1);
+
+        gb->a = t;
+
+        /* Move down data after the gap. */
+        memmove(
+            gb->a + gb->c + new_s - s, gb->a + gb->c, gb->e - gb->c + 1);
+    }
+
+    /* Update values that are after the gap. */
+    gb->c += new_s - s;
+    gb->e += new_s - s;
+    gb->bi_stale = 1;
+
+    return 0;
+}
+
+static size_t undo_size(Gap_buf gb)
+{
+    /* The memory used by the undo and redo history, in bytes. */
+    return (buf_num_used_elements(gb->undo) + buf_num_used_elements(gb->redo))
+        * sizeof(struct operation)
+        + buf_num_used_elements(gb->undo_text)
+        + buf_num_used_elements(gb->redo_text) + gb->br_s + gb->cp_s;
+}
+
+static size_t branch_size(struct branch *b)
+{
+    /* The memory used by the history of a branch and its nested branches. */
+    size_t i, size;
+
+    size = buf_num_used_elements(b->ops) * sizeof(struct operation)
+        + buf_num_used_elements(b->text);
+
+    for (i = 0; i < buf_num_used_elements(b->nested); ++i)
+        size += branch_size(
+            *(struct branch **) get_buf_element(b->nested, i));
+
+    return size;
+}
+
+static int stash_redo(Gap_buf gb)
+{
+    /*
+     * Moves the redo history into a new branch that starts from the current
+     * step. The branches that start after the current step are in the redo
+     * history, so they are nested inside the new branch. Returns 1 if the
+     * branch could not be made, in which case nothing is changed.
+     */
+    struct branch *b = NULL, **list;
+    Buf ops = NULL, text = NULL;
+    size_t num, i, k, count;
+
+    list = NULL;
+    num = buf_num_used_elements(gb->branches);
+    count = 0;
+    for (i = 0; i < num; ++i)
+        if ((*(struct branch **) get_buf_element(gb->branches, i))->step
+            > gb->step)
+            ++count;
+
+    if ((b = calloc(1, sizeof(struct branch))) == NULL)
+        debug(goto error);
+
+    b->ops = NULL;
+    b->text = NULL;
+    b->nested = NULL;
+
+    if ((b->nested = init_buf(count + 1, sizeof(struct branch *))) == NULL)
+        debug(goto error);
+
+    if ((ops = init_buf(1, sizeof(struct operation))) == NULL)
+        debug(goto error);
+
+    if ((text = init_buf(1, sizeof(char))) == NULL)
+        debug(goto error);
+
+    if (push(gb->branches, &b))
+        debug(goto error);
+
+    /* Cannot fail now. */
+
+    /* Move the later branches into the new one, keeping the order. */
+    if (num) {
+        list = get_buf_element(gb->branches, 0);
+        for (i = k = 0; i < num; ++i) {
+            if (list[i]->step > gb->step)
+                push(b->nested, &list[i]);
+            else
+                list[k++] = list[i];
+        }
+
+        list[k] = b;
+        pop_n(gb->branches, NULL, num - k);
+    }
+
+    b->step = gb->step;
+    b->ops = gb->redo;
+    b->text = gb->redo_text;
+    gb->redo = ops;
+    gb->redo_text = text;
+
+    if (gb->save_set && gb->save > gb->step) {
+        /* The last save is in the branch. */
+        b->save = gb->save;
+        b->save_n = gb->save_n;
+        b->save_set = 1;
+        gb->save_set = 0;
+    }
+
+    gb->br_s += buf_num_used_elements(b->ops) * sizeof(struct operation)
+        + buf_num_used_elements(b->text);
+
+    return 0;
+
+error:
+    free_buf(ops);
+    free_buf(text);
+    free_branch(b);
+    return 1;
+}
+
+static void drop_checkpoint(Gap_buf gb, size_t i)
+{
+    /* Drops checkpoint i, keeping the order of the others. */
+    struct checkpoint *list = get_buf_element(gb->cps, 0);
+    size_t num = buf_num_used_elements(gb->cps);
+
+    gb->cp_s -= list[i].n;
+    free(list[i].text);
+    memmove(list + i, list + i + 1, (num - i - 1) * sizeof(struct checkpoint));
+    pop_n(gb->cps, NULL, 1);
+}
+
+static int drop_oldest_checkpoint(Gap_buf gb)
+{
+    /* Drops the oldest checkpoint. Returns 1 if there are none. */
+    if (!buf_num_used_elements(gb->cps))
+        return 1;
+
+    drop_checkpoint(gb, 0);
+
+    return 0;
+}
+
+static void drop_later_checkpoints(Gap_buf gb)
+{
+    /* Drops the checkpoints that are after the current step. */
+    size_t i = buf_num_used_elements(gb->cps);
+
+    while (i--)
+        if (((struct checkpoint *) get_buf_element(gb->cps, i))->step
+            > gb->step)
+            drop_checkpoint(gb, i);
+}
+
+static void take_checkpoint(Gap_buf gb)
+{
+    /*
+     * Copies the text as a checkpoint of the current step. A checkpoint only
+     * saves time, so nothing is taken when it would not fit within the undo
+     * limit, or when there is not enough memory. When full, the oldest
+     * checkpoint is dropped, unless it is of the save step.
+     */
+    struct checkpoint cp;
+    size_t num, i;
+
+    num = buf_num_used_elements(gb->cps);
+    for (i = 0; i < num; ++i)
+        if (((struct checkpoint *) get_buf_element(gb->cps, i))->step
+            == gb->step)
+            return; /* Already taken. */
+
+    cp.step = gb->step;
+    cp.n = gb->g + (gb->e - gb->c);
+
+    if (gb->undo_l && cp.n > gb->undo_l)
+        return;
+
+    if ((cp.text = malloc(cp.n ? cp.n : 1)) == NULL)
+        return;
+
+    memcpy(cp.text, gb->a, gb->g);
+    memcpy(cp.text + gb->g, gb->a + gb->c, gb->e - gb->c);
+
+    if (num == MAX_CHECKPOINTS)
+        drop_checkpoint(gb,
+            gb->save_set
+                && ((struct checkpoint *) get_buf_element(gb->cps, 0))->step
+                    == gb->save);
+
+    if (push(gb->cps, &cp)) {
+        free(cp.text);
+        return;
+    }
+
+    gb->cp_s += cp.n;
+}
+
+static int drop_oldest_branch(Gap_buf gb)
+{
+    /* Drops the oldest branch. Returns 1 if there are none. */
+    struct branch *b;
+
+    if (pop_bottom_n(gb->branches, &b, 1))
+        return 1;
+
+    gb->br_s -= branch_size(b);
+    free_branch(b);
+
+    return 0;
+}
+
+static int drop_oldest(Gap_buf gb)
+{
+    /*
+     * Removes the oldest complete group, or ungrouped operation, from the
+     * bottom of the undo buffer. Returns 1 if there is none.
+     */
+    struct operation *op;
+    size_t num, i, depth, text_n;
+
+    num = buf_num_used_elements(gb->undo);
+    depth = 0;
+    text_n = 0;
+    for (i = 0; i < num; ++i) {
+        op = get_buf_element(gb->undo, i);
+        if (op->type == BEGIN_MULTI)
+            ++depth;
+        else if (op->type == END_MULTI)
+            --depth;
+        else if (op->type == DELETE)
+            text_n += op->n;
+
+        if (!depth)
+            break;
+    }
+
+    if (i == num)
+        return 1; /* Empty, or the group is still being recorded. */
+
+    pop_bottom_n(gb->undo, NULL, i + 1);
+    pop_bottom_n(gb->undo_text, NULL, text_n);
+
+    return 0;
+}
+
+static void limit_undo(Gap_buf gb)
+{
+    /* Drops the oldest history until the buffer is within its limit. */
+    if (gb->mode != NORMAL || !gb->undo_l)
+        return;
+
+    /*
+     * Checkpoints are dropped first, as they only save time, and then the
+     * branches, as they are the least likely to be used.
+     */
+    while (undo_size(gb) > gb->undo_l)
+        if (drop_oldest_checkpoint(gb) && drop_oldest_branch(gb)
+            && drop_oldest(gb))
+            break;
+}
+
+static void new_step(Gap_buf gb)
+{
+    /*
+     * Called when a change starts that is not part of an existing step.
+     * The redo history is kept as a branch. If that fails, then the redo
+     * history is lost, and a later save step can no longer be reached.
+     * The text is still at the current step, so a checkpoint can be taken.
+     */
+    if (buf_num_used_elements(gb->redo) && stash_redo(gb)) {
+        truncate_buf(gb->redo);
+        truncate_buf(gb->redo_text);
+    }
+
+    if (gb->save_set && gb->step < gb->save)
+        gb->save_set = 0;
+
+    drop_later_checkpoints(gb);
+
+    if ((gb->save_set && gb->step == gb->save)
+        || !(gb->step % CHECKPOINT_STEPS))
+        take_checkpoint(gb);
+
+    ++gb->step;
+}
+
+static void update_mod(Gap_buf gb)
+{
+    gb->mod = !gb->save_set || gb->step != gb->save;
+}
+
+static int merge_op(Gap_buf gb, unsigned char type, size_t n)
+{
+    /*
+     * Extends the last operation by a single character insertion or
+     * deletion at g. Returns 1 if the operation cannot be merged.
+     */
+    struct operation *top;
+    Buf text;
+    char *t, prev, ch;
+    size_t num;
+
+    if (gb->mode != NORMAL || !gb->merge || n != 1
+        || !(num = buf_num_used_elements(gb->undo)))
+        return 1;
+
+    top = get_buf_element(gb->undo, num - 1);
+    if (top->type != type)
+        return 1;
+
+    text = gb->undo_text;
+    num = buf_num_used_elements(text);
+
+    if (type == INSERT && top->g + top->n == gb->g) {
+        prev = *(gb->a + gb->g - 1);
+        ch = *(gb->a + gb->g);
+    } else if (type == DELETE && top->g == gb->g) {
+        /* Forwards deletion. The last character deleted is on top. */
+        prev = *(char *) get_buf_element(text, num - 1);
+        ch = *(gb->a + gb->c);
+    } else if (type == DELETE && gb->g + 1 == top->g
+        && top->n < MAX_BACKWARDS_MERGE) {
+        /* Backwards deletion. The last character deleted is at the start. */
+        prev = *(char *) get_buf_element(text, num - top->n);
+        ch = *(gb->a + gb->c);
+    } else {
+        return 1;
+    }
+
+    if (isspace((unsigned char) prev) && !isspace((unsigned char) ch))
+        return 1; /* Start of a new word. */
+
+    if (type == DELETE) {
+        if (push(text, &ch))
+            debug(return -1);
+
+        if (gb->g + 1 == top->g) {
+            /* Keep the text in order by moving the new character down. */
+            t = get_buf_element(text, num - top->n);
+            memmove(t + 1, t, top->n);
+            *t = ch;
+            top->g = gb->g;
+        }
+    }
+
+    ++top->n;
+
+    return 0;
+}
+
+static int record_op(Gap_buf gb, unsigned char type, size_t n)
+{
+    /* Records an insertion or deletion of n characters at g. */
+    struct operation op;
+
+    switch (merge_op(gb, type, n)) {
+    case 0:
+        /* Redo is already empty, as nothing has been undone. */
+        limit_undo(gb);
+        return 0;
+    case -1:
+        debug(return 1);
+    }
+
+    op.g = gb->g; /* Record g before it changes. */
+    op.n = n;
+    op.type = type;
+
+    /* The text of a deletion is immediately after the gap. */
+    if (type == DELETE && push_n(record_text(gb), gb->a + gb->c, n))
+        debug(return 1);
+
+    if (push(record_buf(gb), &op)) {
+        if (type == DELETE)
+            pop_n(record_text(gb), NULL, n);
+
+        debug(return 1);
+    }
+
+    if (gb->mode == NORMAL) {
+        if (!gb->depth)
+            new_step(gb);
+
+        /* The redo history has been moved into a branch, or is lost. */
+        truncate_buf(gb->redo);
+        truncate_buf(gb->redo_text);
+    }
+
+    gb->merge = gb->mode == NORMAL && n == 1;
+
+    limit_undo(gb);
+
+    return 0;
+}
 
+static int commit_insert(Gap_buf gb, size_t n)
+{
+    /*
+     * Commits n characters that have already been written to the start of
+     * the gap, making them part of the text before the gap.
+     */
     size_t i;
+    const char *last_nl = NULL;
+
+    if (reserve_buf(gb->nl_before, count_nl(gb->a + gb->g, n, &last_nl)))
+        debug(return 1);
+
+    if (record_op(gb, INSERT, n))
+        debug(return 1);
+
+    /* Cannot fail now. */
+
+    drop_rows(gb, gb->g);
+    damage(gb, n, 0);
+    touch_braces(gb, gb->g, n);
+
+    /* Update the line index. */
+    for (i = gb->g; i < gb->g + n; ++i)
+        if (*(gb->a + i) == '\n')
+            push(gb->nl_before, &i);
+
+    gb->g += n;
+
+    clear_mark(gb);
+
+    update_mod(gb);
+
+    return 0;
+}
+
+int gb_insert_mem(Gap_buf gb, const char *mem, size_t n)
+{
+    /*
+     * Inserts n characters before the cursor as one operation.
+     * The gap is grown at most once and the characters are copied
+     * in one go.
+     */
+    clear_sticky_column(gb);
+
+    if (!n)
+        return 0;
+
+    if (grow_gap(gb, n))
+        debug(return 1);
+
+    memcpy(gb->a + gb->g, mem, n);
+
+    return commit_insert(gb, n);
+}
+
+int gb_insert_ch(Gap_buf gb, char ch)
+{
+    /*
+     * The character is written at g, then g is incremented.
+     *
+     * Before:
+     * woXXXXld~
+     * ^ ^   ^ ^
+     * | |   | |
+     * a g   c e
+     *
+     * After:
+     * worXXXld~
+     * ^  ^  ^ ^
+     * |  |  | |
+     * a  g  c e
+     *
+     */
+
+    return gb_insert_mem(gb, &ch, 1);
+}
+
+int gb_delete_mem(Gap_buf gb, size_t n)
+{
+    /* Deletes n characters from the cursor onwards as one operation. */
+    const char *last_nl = NULL;
+
+    clear_sticky_column(gb);
+
+    /* Cannot delete the last character in the gap buffer. */
+    if (n > gb->e - gb->c)
+        return 1;
+
+    if (!n)
+        return 0;
+
+    if (record_op(gb, DELETE, n))
+        debug(return 1);
+
+    /* Cannot fail now. */
+
+    drop_rows(gb, gb->g);
+    damage(gb, 0, n);
+    touch_braces(gb, gb->c, n);
+
+    /* Remove the deleted newline characters from the line index. */
+    pop_n(gb->nl_after, NULL, count_nl(gb->a + gb->c, n, &last_nl));
+
+    /* Expand the gap to the right. */
+    gb->c += n;
+
+    clear_mark(gb);
+
+    update_mod(gb);
+
+    shrink_gap(gb, 0);
+
+    return 0;
+}
+
+int gb_delete_ch(Gap_buf gb)
+{
+    /*
+     * c is incremented.
+     *
+     * Before:
+     * elepXXXXjhant~
+     * ^   ^   ^    ^
+     * |   |   |    |
+     * a   g   c    e
+     *
+     * After:
+     * elepXXXXXhant~
+     * ^   ^    ^   ^
+     * |   |    |   |
+     * a   g    c   e
+     *
+     * Not displaying the gap:
+     * Before:
+     * elepjhant~
+     *     ^
+     *     |
+     *     c
+     *
+     * After:
+     * elephant~
+     *     ^
+     *     |
+     *     c
+     *
+     */
+
+    return gb_delete_mem(gb, 1);
+}
+
+int gb_left_ch(Gap_buf gb)
+{
+    /*
+     * g and c are decremented, then the character at g is copied to c.
+     *
+     * Before:
+     * worXXXXld~
+     * ^  ^   ^ ^
+     * |  |   | |
+     * a  g   c e
+     *
+     * Decrement:
+     * worXXXXld~
+     * ^ ^   ^  ^
+     * | |   |  |
+     * a g   c  e
+     *
+     * After:
+     * woXXXXrld~
+     * ^ ^   ^  ^
+     * | |   |  |
+     * a g   c  e
+     *
+     */
+
+    size_t d;
 
     clear_sticky_column(gb);
 
     if (!gb->g)
         return 1; /* At start of gap buffer. */
 
+    if (*(gb->a + gb->g - 1) == '\n' && reserve_buf(gb->nl_after, 1))
+        debug(return 1);
+
     /* Cannot fail now. */
 
     if ((*(gb->a + --gb->c) = *(gb->a + --gb->g)) == '\n') {
-        --gb->row; /* Gone up a line. */
+        /* Gone up a line. */
+        pop(gb->nl_before, &d);
+        d = gb->e - gb->c;
+        push(gb->nl_after, &d);
+    }
 
-        /* Need to recalculate the column number. */
-        i = gb->g;
-        while (i && *(gb->a + --i) != '\n') ++gb->col;
-    } else {
-        --gb->col;
+    touch_braces(gb, gb->g, 1);
+    touch_braces(gb, gb->c, 1);
+
+    return 0;
+}
+
+int gb_right_ch(Gap_buf gb)
+{
+    /*
+     * The character at c is copied to g, then g and c are incremented.
+     *
+     * Before:
+     * woXXXXrld~
+     * ^ ^   ^  ^
+     * | |   |  |
+     * a g   c  e
+     *
+     * Copy:
+     * worXXXrld~
+     * ^ ^   ^  ^
+     * | |   |  |
+     * a g   c  e
+     *
+     * After:
+     * worXXXXld~
+     * ^  ^   ^ ^
+     * |  |   | |
+     * a  g   c e
+     *
+     */
+
+    size_t d;
+
+    clear_sticky_column(gb);
+
+    if (gb->c == gb->e)
+        return 1; /* At end of the buffer. */
+
+    if (*(gb->a + gb->c) == '\n' && reserve_buf(gb->nl_before, 1))
+        debug(return 1);
+
+    /* Cannot fail now. */
+
+    if ((*(gb->a + gb->g++) = *(gb->a + gb->c++)) == '\n') {
+        /* Gone down a line. */
+        pop(gb->nl_after, &d);
+        d = gb->g - 1;
+        push(gb->nl_before, &d);
     }
 
-    return 0;
+    touch_braces(gb, gb->g - 1, 1);
+    touch_braces(gb, gb->c - 1, 1);
+
+    return 0;
+}
+
+/* ######################################################################## */
+
+static size_t *top_reversed(Buf b, size_t n)
+{
+    /*
+     * Reverses the top n elements of a line index, so that they can be pushed
+     * onto the other side in one go, and returns the first of them.
+     */
+    size_t *p, t, i, j;
+
+    p = get_buf_element(b, buf_num_used_elements(b) - n);
+    for (i = 0, j = n - 1; i < j; ++i, --j) {
+        t = p[i];
+        p[i] = p[j];
+        p[j] = t;
+    }
+
+    return p;
+}
+
+int gb_move_to(Gap_buf gb, size_t g)
+{
+    /*
+     * Moves the cursor to the position that has a g-value of g,
+     * relocating the gap with a single memmove.
+     */
+    size_t n, count, i, *p;
+    const char *last_nl = NULL;
+
+    clear_sticky_column(gb);
+
+    if (g > gb->g + (gb->e - gb->c))
+        return 1; /* Past the end of the buffer. */
+
+    if (g < gb->g) {
+        /* Move the text between g and the gap to after the gap. */
+        n = gb->g - g;
+        count = count_nl(gb->a + g, n, &last_nl);
+        if (reserve_buf(gb->nl_after, count))
+            debug(return 1);
+
+        /* Cannot fail now. */
+
+        memmove(gb->a + gb->c - n, gb->a + g, n);
+        gb->g -= n;
+        gb->c -= n;
+        touch_braces(gb, gb->g, n);
+        touch_braces(gb, gb->c, n);
+
+        /* Transfer the line index in bulk, closest to the gap last. */
+        if (count) {
+            p = top_reversed(gb->nl_before, count);
+            for (i = 0; i < count; ++i)
+                p[i] = gb->e - (gb->c + (p[i] - gb->g));
+
+            push_n(gb->nl_after, p, count);
+            pop_n(gb->nl_before, NULL, count);
+        }
+    } else if (g > gb->g) {
+        /* Move the text between the gap and g to before the gap. */
+        n = g - gb->g;
+        count = count_nl(gb->a + gb->c, n, &last_nl);
+        if (reserve_buf(gb->nl_before, count))
+            debug(return 1);
+
+        /* Cannot fail now. */
+
+        /* Transfer the line index in bulk, closest to the gap last. */
+        if (count) {
+            p = top_reversed(gb->nl_after, count);
+            for (i = 0; i < count; ++i)
+                p[i] = gb->g + (gb->e - p[i] - gb->c);
+
+            push_n(gb->nl_before, p, count);
+            pop_n(gb->nl_after, NULL, count);
+        }
+
+        memmove(gb->a + gb->g, gb->a + gb->c, n);
+        touch_braces(gb, gb->g, n);
+        touch_braces(gb, gb->c, n);
+        gb->g += n;
+        gb->c += n;
+    }
+
+    return 0;
+}
+
+int gb_line_start(Gap_buf gb, size_t row, size_t *g)
+{
+    /*
+     * Gets the g-value of the start of a row, using the line index.
+     * Rows start from 1. Returns 1 if the row does not exist.
+     */
+    size_t num_before, j;
+
+    if (!row)
+        return 1;
+
+    if (row == 1) {
+        *g = 0;
+        return 0;
+    }
+
+    /* The start of the row follows the (row - 1)-th newline character. */
+    num_before = buf_num_used_elements(gb->nl_before);
+    if (row - 1 <= num_before) {
+        *g = *(size_t *) get_buf_element(gb->nl_before, row - 2) + 1;
+        return 0;
+    }
+
+    j = row - 2 - num_before;
+    if (j >= buf_num_used_elements(gb->nl_after))
+        return 1;
+
+    *g = nl_after_g(gb, j) + 1;
+    return 0;
+}
+
+int gb_goto_line(Gap_buf gb, size_t row)
+{
+    size_t g;
+
+    if (gb_line_start(gb, row, &g))
+        return 1;
+
+    return gb_move_to(gb, g);
 }
 
-int gb_right_ch(Gap_buf gb)
+static size_t line_end(Gap_buf gb, size_t row)
 {
     /*
-     * The character at c is copied to g, then g and c are incremented.
-     *
-     * Before:
-     * woXXXXrld~
-     * ^ ^   ^  ^
-     * | |   |  |
-     * a g   c  e
-     *
-     * Copy:
-     * worXXXrld~
-     * ^ ^   ^  ^
-     * | |   |  |
-     * a g   c  e
-     *
-     * After:
-     * worXXXXld~
-     * ^  ^   ^ ^
-     * |  |   | |
-     * a  g   c e
-     *
+     * Returns the g-value of the end of an existing row, which is either
+     * its newline character or the end of the buffer.
      */
+    size_t g;
 
-    clear_sticky_column(gb);
-
-    if (gb->c == gb->e)
-        return 1; /* At end of the buffer. */
-
-    /* Cannot fail now. */
-
-    if ((*(gb->a + gb->g++) = *(gb->a + gb->c++)) == '\n') {
-        ++gb->row;
-        gb->col = 0;
-    } else {
-        ++gb->col;
-    }
+    if (gb_line_start(gb, row + 1, &g))
+        return gb->g + (gb->e - gb->c);
 
-    return 0;
+    return g - 1;
 }
 
 /* ######################################################################## */
@@ -446,59 +1660,116 @@ static int record_multi(Gap_buf gb, unsigned char type)
         debug(return 1);
 
     op.g = 0;
+    op.n = 0;
     op.type = type;
-    op.ch = '\0';
 
     if (push(record_buf(gb), &op))
         debug(return 1);
 
+    gb->merge = 0;
+
+    if (gb->mode == NORMAL) {
+        if (type == BEGIN_MULTI) {
+            if (!gb->depth)
+                new_step(gb);
+
+            ++gb->depth;
+        } else if (gb->depth) {
+            --gb->depth;
+        }
+    }
+
+    if (type == END_MULTI)
+        limit_undo(gb);
+
     return 0;
 }
 
+static void join_run(Gap_buf gb, struct operation *op)
+{
+    /*
+     * Joins older operations of the same type into op while together they
+     * form one span, so that the span is replayed with one gap move and one
+     * copy. Only used inside a group, as the operations are undone together.
+     */
+    Buf b = replay_buf(gb);
+    struct operation *next;
+    size_t num;
+
+    while ((num = buf_num_used_elements(b))) {
+        next = get_buf_element(b, num - 1);
+
+        if (next->type != op->type || add_overflow(op->n, next->n))
+            break;
+
+        if (next->g == op->g) {
+            /*
+             * An insertion that is after the span, or a deletion that was
+             * before it. The text of the deletion is already below the text
+             * of the span in the text buffer, so they are in order.
+             */
+        } else if (op->type == INSERT && next->g + next->n == op->g) {
+            op->g = next->g; /* An insertion that is before the span. */
+        } else {
+            break;
+        }
+
+        op->n += next->n;
+        pop_n(b, NULL, 1);
+    }
+}
+
 static int undo(Gap_buf gb, int mode)
 {
     struct operation op;
     size_t depth;
+    int replayed = 0;
+    Buf text;
 
     if (mode != UNDO && mode != REDO)
         debug(goto error);
 
     gb->mode = mode;
+    gb->merge = 0;
 
     depth = 0;
     do {
         if (pop(replay_buf(gb), &op))
             break; /* No more. */
 
+        replayed = 1;
+
         if (op.type == BEGIN_MULTI || op.type == END_MULTI) {
-            if (op.g || op.ch) /* These should not be used. */
+            if (op.g || op.n) /* These should not be used. */
                 debug(goto error);
         } else {
-            /* Move into position. */
-            while (gb->g < op.g)
-                if (gb_right_ch(gb))
-                    debug(goto error); /* Should not fail. */
+            if (depth)
+                join_run(gb, &op);
 
-            while (gb->g > op.g)
-                if (gb_left_ch(gb))
-                    debug(goto error); /* Should not fail. */
-
-            /* Check. */
-            if (gb->g != op.g)
+            /* Move into position. */
+            if (gb_move_to(gb, op.g))
                 debug(goto error); /* Should not fail. */
         }
 
         /* Perform the opposite operation. */
         switch (op.type) {
         case INSERT:
-            if (gb_delete_ch(gb))
+            if (gb_delete_mem(gb, op.n))
                 debug(goto error);
 
             break;
         case DELETE:
-            if (gb_insert_ch(gb, op.ch))
+            /* The text is on top of the replay text buffer. */
+            text = replay_text(gb);
+            if (op.n > buf_num_used_elements(text))
+                debug(goto error);
+
+            if (gb_insert_mem(gb,
+                    get_buf_element(text, buf_num_used_elements(text) - op.n),
+                    op.n))
                 debug(goto error);
 
+            pop_n(text, NULL, op.n);
             break;
         case BEGIN_MULTI:
             --depth;
@@ -518,6 +1789,17 @@ static int undo(Gap_buf gb, int mode)
     } while (depth);
 
     gb->mode = NORMAL;
+
+    /* A step is only replayed as a whole outside of a recording. */
+    if (replayed && !gb->depth) {
+        if (mode == UNDO)
+            --gb->step;
+        else
+            ++gb->step;
+
+        update_mod(gb);
+    }
+
     return 0;
 
 error:
@@ -535,6 +1817,142 @@ int gb_redo(Gap_buf gb)
     return undo(gb, REDO);
 }
 
+static size_t undo_steps(Gap_buf gb, Buf b, size_t max)
+{
+    /*
+     * Counts the complete steps in an undo or redo buffer, from the top,
+     * stopping once max are found. The oldest steps can have been dropped.
+     * A group that is still being recorded is not complete, so none are
+     * counted.
+     */
+    struct operation *op;
+    size_t i, depth = 0, n = 0;
+
+    if (gb->depth)
+        return 0;
+
+    for (i = buf_num_used_elements(b); i && n < max; --i) {
+        op = get_buf_element(b, i - 1);
+        if (op->type == END_MULTI)
+            ++depth;
+        else if (op->type == BEGIN_MULTI)
+            --depth;
+
+        if (!depth)
+            ++n;
+    }
+
+    return n;
+}
+
+int gb_switch_branch(Gap_buf gb)
+{
+    /*
+     * Undoes back to the closest step that has a branch, and swaps the redo
+     * history with the oldest branch from that step. Redo then follows that
+     * branch. Repeating cycles through the branches from that step.
+     * Returns 1 if there is no branch that can be reached.
+     */
+    struct branch *b, **list;
+    size_t num, i, k, fork = 0;
+    int found = 0;
+
+    num = buf_num_used_elements(gb->branches);
+    for (i = 0; i < num; ++i) {
+        b = *(struct branch **) get_buf_element(gb->branches, i);
+        if (b->step <= gb->step && (!found || b->step > fork)) {
+            fork = b->step;
+            found = 1;
+        }
+    }
+
+    /* Nothing is undone unless the fork can be reached. */
+    if (!found
+        || undo_steps(gb, gb->undo, gb->step - fork) < gb->step - fork)
+        return 1;
+
+    while (gb->step > fork)
+        if (!buf_num_used_elements(gb->undo) || gb_undo(gb))
+            debug(return 1);
+
+    /* Make sure that there is room to move the nested branches. */
+    b = NULL;
+    num = buf_num_used_elements(gb->branches);
+    for (k = 0; k < num; ++k) {
+        b = *(struct branch **) get_buf_element(gb->branches, k);
+        if (b->step == fork)
+            break;
+    }
+
+    if (reserve_buf(gb->branches, buf_num_used_elements(b->nested) + 1))
+        debug(return 1);
+
+    /* Keep the current redo history. This does not move the oldest branch. */
+    if (buf_num_used_elements(gb->redo) && stash_redo(gb))
+        debug(return 1);
+
+    /* Cannot fail now. */
+
+    /* The checkpoints after the fork are not in the branch. */
+    drop_later_checkpoints(gb);
+
+    /* Take the oldest branch out of the list. */
+    num = buf_num_used_elements(gb->branches);
+    list = get_buf_element(gb->branches, 0);
+    for (k = 0; list[k]->step != fork; ++k)
+        ;
+
+    b = list[k];
+    memmove(list + k, list + k + 1, (num - k - 1) * sizeof(struct branch *));
+    pop_n(gb->branches, NULL, 1);
+
+    for (i = 0; i < buf_num_used_elements(b->nested); ++i)
+        push(gb->branches, get_buf_element(b->nested, i));
+
+    free_buf(gb->redo);
+    free_buf(gb->redo_text);
+    gb->redo = b->ops;
+    gb->redo_text = b->text;
+    gb->br_s -= buf_num_used_elements(b->ops) * sizeof(struct operation)
+        + buf_num_used_elements(b->text);
+
+    if (b->save_set && b->save_n == gb->save_n) {
+        gb->save = b->save;
+        gb->save_set = 1;
+    }
+
+    free_buf(b->nested);
+    free(b);
+
+    gb->merge = 0;
+    update_mod(gb);
+
+    return 0;
+}
+
+void gb_set_undo_limit(Gap_buf gb, size_t limit)
+{
+    /* Sets the undo memory limit in bytes. Zero means no limit. */
+    gb->undo_l = limit;
+    limit_undo(gb);
+}
+
+size_t gb_undo_size(Gap_buf gb)
+{
+    return undo_size(gb);
+}
+
+int gb_drop_oldest_undo(Gap_buf gb)
+{
+    /*
+     * Drops the oldest checkpoint, branch or undo group, in the same order as
+     * limit_undo. This lets a limit be applied across buffers. Returns 1 if
+     * there is nothing that can be dropped.
+     */
+    return drop_oldest_checkpoint(gb) && drop_oldest_branch(gb)
+        && drop_oldest(gb);
+}
+
 /* ######################################################################## */
 
 /* ######################################################################## */
@@ -543,196 +1961,413 @@ int gb_redo(Gap_buf gb)
 
 void gb_start_of_line(Gap_buf gb)
 {
-    while (gb->g && *(gb->a + gb->g - 1) != '\n')
-        if (gb_left_ch(gb))
-            break;
+    gb_move_to(gb, line_start(gb));
 }
 
 void gb_end_of_line(Gap_buf gb)
 {
-    while (*(gb->a + gb->c) != '\n')
-        if (gb_right_ch(gb))
-            break;
+    gb_move_to(gb, line_end(gb, cursor_row(gb)));
 }
 
 void gb_start_of_buffer(Gap_buf gb)
 {
-    while (!gb_left_ch(gb));
+    gb_move_to(gb, 0);
 }
 
 void gb_end_of_buffer(Gap_buf gb)
 {
-    while (!gb_right_ch(gb));
+    gb_move_to(gb, gb->g + (gb->e - gb->c));
 }
 
-int gb_up_line(Gap_buf gb)
+static int move_to_row(Gap_buf gb, size_t row)
 {
-    size_t row_orig, backup_sc;
-
-    row_orig = gb->row;
+    /*
+     * Moves to the sticky column of an existing row, or to the end of the
+     * row if it is shorter.
+     */
+    size_t start, end, backup_sc;
 
     if (!gb->sc_set) {
-        gb->sc = gb->col;
+        gb->sc = cursor_col(gb);
         gb->sc_set = 1;
     }
 
     backup_sc = gb->sc;
 
-    if (row_orig == 1)
-        return 1; /* On top line already. */
+    if (gb_line_start(gb, row, &start))
+        return 1;
 
-    while (!gb_left_ch(gb))
-        if (gb->row == row_orig - 1 && gb->col <= backup_sc)
-            break;
+    end = line_end(gb, row);
+
+    if (gb_move_to(gb, end - start < backup_sc ? end : start + backup_sc))
+        debug(return 1);
 
-    /* Restore, as sticky column will be cleared by gb_left_ch function. */
+    /* Restore, as sticky column will be cleared by gb_move_to. */
     gb->sc = backup_sc;
     gb->sc_set = 1;
 
-    if (gb->row == row_orig - 1)
-        return 0; /* Moved up a line, so success. */
+    return 0;
+}
 
-    return 1;
+int gb_up_line(Gap_buf gb)
+{
+    if (cursor_row(gb) == 1) {
+        if (!gb->sc_set) {
+            gb->sc = cursor_col(gb);
+            gb->sc_set = 1;
+        }
+
+        return 1; /* On top line already. */
+    }
+
+    return move_to_row(gb, cursor_row(gb) - 1);
 }
 
 int gb_down_line(Gap_buf gb)
 {
-    size_t row_orig, col_orig, backup_sc;
+    if (add_overflow(cursor_row(gb), 1))
+        debug(return 1);
 
-    row_orig = gb->row;
-    col_orig = gb->col; /* To go back if on the last line. */
+    return move_to_row(gb, cursor_row(gb) + 1);
+}
 
-    if (!gb->sc_set) {
-        gb->sc = gb->col;
-        gb->sc_set = 1;
-    }
+int gb_forward_search(Gap_buf gb, Gap_buf search, int icase)
+{
+    /*
+     * Forward of the cursor, exact match search. Case is ignored if icase
+     * is set. Excludes a match at the current cursor position.
+     */
+    char *p;
 
-    backup_sc = gb->sc;
+    if (gb->c == gb->e)
+        return 1; /* No match possible. */
 
-    if (add_overflow(row_orig, 1))
-        debug(return 1);
+    gb_start_of_buffer(search);
 
-    while (!gb_right_ch(gb))
-        if (gb->row == row_orig + 1
-            && (gb->col == backup_sc || *(gb->a + gb->c) == '\n'))
-            break;
+    /* The end of buffer character is not part of the search. */
+    if ((p = (icase ? memcasemem : memmem)(gb->a + gb->c + 1,
+             gb->e - gb->c - 1, search->a + search->c, search->e - search->c))
+        == NULL)
+        return 1; /* No match found. */
+
+    if (gb_move_to(gb, gb->g + (p - (gb->a + gb->c))))
+        debug(return 1);
 
-    if (gb->row == row_orig)
-        while (gb->col != col_orig)
-            if (gb_left_ch(gb))
-                break;
+    return 0;
+}
 
-    /* Restore, as sticky column will be cleared by left and right functions.
+int gb_backward_search(Gap_buf gb, Gap_buf search, int icase)
+{
+    /*
+     * Backward of the cursor, exact match search. Case is ignored if icase
+     * is set. The match must end at or before the cursor, so the text before
+     * the gap is searched in place.
      */
-    gb->sc = backup_sc;
-    gb->sc_set = 1;
+    char *p;
 
-    if (gb->row == row_orig + 1)
-        return 0; /* Moved down line, so success. */
+    gb_start_of_buffer(search);
 
-    return 1;
+    if ((p = (icase ? memrcasemem : memrmem)(gb->a, gb->g,
+             search->a + search->c, search->e - search->c))
+        == NULL)
+        return 1; /* No match found. */
+
+    if (gb_move_to(gb, p - gb->a))
+        debug(return 1);
+
+    return 0;
 }
 
-int gb_forward_search(Gap_buf gb, Gap_buf search)
+int gb_regex_search(Gap_buf gb, Regex re)
 {
     /*
-     * Forward of the cursor, exact match search (case sensitive).
-     * Excludes a match at the current cursor position.
+     * Forward of the cursor, regular expression search. Excludes a match at
+     * the current cursor position. The text on both sides of the gap is
+     * searched in place.
      */
-    char *p;
+    size_t m;
 
     if (gb->c == gb->e)
         return 1; /* No match possible. */
 
-    gb_start_of_buffer(search);
-    if ((p = memmem(gb->a + gb->c + 1, gb->e - gb->c, search->a + search->c,
-             search->e - search->c))
-        == NULL)
+    if (regex_search(
+            re, gb->a, gb->g, gb->a + gb->c, gb->e - gb->c, gb->g + 1, &m))
         return 1; /* No match found. */
 
-    while (gb->a + gb->c != p)
-        if (gb_right_ch(gb))
+    if (gb_move_to(gb, m))
+        debug(return 1);
+
+    return 0;
+}
+
+static int brace_type(char ch, int *type)
+{
+    /* Returns 1 for an opening brace, -1 for a closing brace, else 0. */
+    switch (ch) {
+    case '(':
+        *type = 0;
+        return 1;
+    case ')':
+        *type = 0;
+        return -1;
+    case '[':
+        *type = 1;
+        return 1;
+    case ']':
+        *type = 1;
+        return -1;
+    case '{':
+        *type = 2;
+        return 1;
+    case '}':
+        *type = 2;
+        return -1;
+    case '<':
+        *type = 3;
+        return 1;
+    case '>':
+        *type = 3;
+        return -1;
+    default:
+        return 0;
+    }
+}
+
+static void add_braces(struct brace_node *node, const char *mem, size_t n)
+{
+    /* Adds the braces in a span of memory to the end of a node. */
+    size_t j;
+    int t, dir;
+
+    for (j = 0; j < n; ++j)
+        if ((dir = brace_type(mem[j], &t))) {
+            node->delta[t] += dir;
+            if (node->delta[t] < node->low[t])
+                node->low[t] = node->delta[t];
+        }
+}
+
+static void set_block(Gap_buf gb, size_t i)
+{
+    /* Sets the node of block i from the text in it, which skips the gap. */
+    struct brace_node *node;
+    size_t s, end;
+    int t;
+
+    node = gb->bi + gb->bi_n + i;
+    for (t = 0; t < NUM_BRACE_TYPES; ++t) {
+        node->delta[t] = 0;
+        node->low[t] = 0;
+    }
+
+    s = i * BRACE_BLOCK;
+    end = s + BRACE_BLOCK;
+    if (end > gb->e)
+        end = gb->e;
+
+    if (s < gb->g)
+        add_braces(node, gb->a + s, (end < gb->g ? end : gb->g) - s);
+
+    if (s < gb->c)
+        s = gb->c;
+
+    if (s < end)
+        add_braces(node, gb->a + s, end - s);
+}
+
+static void join_nodes(Gap_buf gb, size_t k)
+{
+    /* Sets node k from its two children. */
+    struct brace_node *node, *left, *right;
+    int t;
+
+    node = gb->bi + k;
+    left = gb->bi + 2 * k;
+    right = left + 1;
+    for (t = 0; t < NUM_BRACE_TYPES; ++t) {
+        node->delta[t] = left->delta[t] + right->delta[t];
+        node->low[t] = left->low[t];
+        if (left->delta[t] + right->low[t] < node->low[t])
+            node->low[t] = left->delta[t] + right->low[t];
+    }
+}
+
+static int build_braces(Gap_buf gb)
+{
+    /* Builds the whole brace index. */
+    struct brace_node *t;
+    unsigned char *d;
+    size_t num, n, i;
+
+    num = gb->e / BRACE_BLOCK + 1;
+    for (n = 1; n < num; n *= 2)
+        ;
+
+    if (mult_overflow(2 * n, sizeof(struct brace_node)))
+        debug(return 1);
+
+    if (n != gb->bi_n) {
+        if ((t = realloc(gb->bi, 2 * n * sizeof(struct brace_node))) == NULL)
+            debug(return 1);
+
+        gb->bi = t;
+
+        if ((d = realloc(gb->bi_dirty, n)) == NULL)
             debug(return 1);
 
-    return 0;
+        gb->bi_dirty = d;
+        gb->bi_n = n;
+    }
+
+    for (i = 0; i < n; ++i)
+        set_block(gb, i);
+
+    for (i = n - 1; i; --i)
+        join_nodes(gb, i);
+
+    memset(gb->bi_dirty, 0, n);
+    truncate_buf(gb->bi_list);
+    gb->bi_stale = 0;
+
+    return 0;
+}
+
+static int sync_braces(Gap_buf gb)
+{
+    /* Brings the out of date blocks of the brace index up to date. */
+    size_t i, k;
+
+    if (gb->bi_stale)
+        return build_braces(gb);
+
+    while (!pop(gb->bi_list, &i)) {
+        gb->bi_dirty[i] = 0;
+        set_block(gb, i);
+        for (k = (gb->bi_n + i) / 2; k; k /= 2)
+            join_nodes(gb, k);
+    }
+
+    return 0;
+}
+
+static size_t find_close(Gap_buf gb, int t, size_t k, size_t lo, size_t hi,
+    size_t from, long *depth)
+{
+    /*
+     * Returns the first block, from block from onwards, where the depth falls
+     * below zero, or bi_n if there is none. Node k covers blocks lo to hi
+     * (exclusive). The blocks that are passed over are added to the depth.
+     */
+    struct brace_node *node;
+    size_t i;
+
+    node = gb->bi + k;
+    if (hi <= from)
+        return gb->bi_n;
+
+    if (lo >= from && *depth + node->low[t] >= 0) {
+        *depth += node->delta[t];
+        return gb->bi_n;
+    }
+
+    if (hi - lo == 1)
+        return lo;
+
+    if ((i = find_close(gb, t, 2 * k, lo, (lo + hi) / 2, from, depth))
+        != gb->bi_n)
+        return i;
+
+    return find_close(gb, t, 2 * k + 1, (lo + hi) / 2, hi, from, depth);
 }
 
-int gb_match_brace(Gap_buf gb)
+static size_t find_open(Gap_buf gb, int t, size_t k, size_t lo, size_t hi,
+    size_t to, long *depth)
 {
-    /* Moves to the matching brace that is under the cursor. */
-
-    int (*move)(Gap_buf);
-    int (*back)(Gap_buf);
+    /*
+     * Returns the last block, from block to backwards, where the depth,
+     * going backwards, rises above zero, or bi_n if there is none.
+     */
+    struct brace_node *node;
+    size_t i;
 
-    char brace, target, ch;
-    size_t g_orig, depth;
+    node = gb->bi + k;
+    if (lo > to)
+        return gb->bi_n;
 
-    brace = *(gb->a + gb->c);
+    if (hi <= to + 1 && *depth + node->delta[t] - node->low[t] <= 0) {
+        *depth += node->delta[t];
+        return gb->bi_n;
+    }
 
-    switch (brace) {
-    case '<':
-        target = '>';
-        move = &gb_right_ch;
-        break;
-    case '(':
-        target = ')';
-        move = &gb_right_ch;
-        break;
-    case '{':
-        target = '}';
-        move = &gb_right_ch;
-        break;
-    case '[':
-        target = ']';
-        move = &gb_right_ch;
-        break;
+    if (hi - lo == 1)
+        return lo;
 
-    case '>':
-        target = '<';
-        move = &gb_left_ch;
-        break;
-    case ')':
-        target = '(';
-        move = &gb_left_ch;
-        break;
-    case '}':
-        target = '{';
-        move = &gb_left_ch;
-        break;
-    case ']':
-        target = '[';
-        move = &gb_left_ch;
-        break;
+    if ((i = find_open(gb, t, 2 * k + 1, (lo + hi) / 2, hi, to, depth))
+        != gb->bi_n)
+        return i;
 
-    default:
-        return 1; /* Not a brace style character. */
-    }
+    return find_open(gb, t, 2 * k, lo, (lo + hi) / 2, to, depth);
+}
 
-    /* Backup starting position in case there is no match. */
-    g_orig = gb->g;
+int gb_match_brace(Gap_buf gb)
+{
+    /*
+     * Moves to the matching brace that is under the cursor. The brace index
+     * finds the block that holds the match, so at most two blocks are
+     * scanned. If there is no match, then the cursor does not move.
+     */
+    size_t i, b, end;
+    long depth = 0;
+    int t, u, dir;
 
-    depth = 1; /* As already on a brace. */
+    if (!(dir = brace_type(*(gb->a + gb->c), &t)))
+        return 1; /* Not a brace style character. */
 
-    while (!move(gb)) {
-        ch = *(gb->a + gb->c);
-        if (ch == brace)
-            ++depth;
-        else if (ch == target)
-            --depth;
+    if (sync_braces(gb))
+        debug(return 1);
 
-        if (!depth)
-            return 0; /* Success. */
+    if (dir > 0) {
+        /* Forwards, from after the cursor to the end of the buffer. */
+        i = gb->c + 1;
+        b = i / BRACE_BLOCK;
+        while (1) {
+            end = (b + 1) * BRACE_BLOCK;
+            if (end > gb->e)
+                end = gb->e;
+
+            for (; i < end; ++i)
+                if ((dir = brace_type(*(gb->a + i), &u)) && u == t
+                    && (depth += dir) < 0)
+                    return gb_move_to(gb, gb->g + (i - gb->c));
+
+            b = find_close(gb, t, 1, 0, gb->bi_n, b + 1, &depth);
+            if (b == gb->bi_n)
+                return 1; /* Not found. */
+
+            i = b * BRACE_BLOCK;
+        }
     }
 
-    /* Not found. Go back to starting location. */
-    if (move == &gb_right_ch)
-        back = &gb_left_ch;
-    else
-        back = &gb_right_ch;
+    /* Backwards, from before the gap to the start of the buffer. */
+    if (!gb->g)
+        return 1;
 
-    while (gb->g != g_orig) back(gb);
+    i = gb->g;
+    b = (i - 1) / BRACE_BLOCK;
+    while (1) {
+        while (i > b * BRACE_BLOCK) {
+            --i;
+            if ((dir = brace_type(*(gb->a + i), &u)) && u == t
+                && (depth += dir) > 0)
+                return gb_move_to(gb, i);
+        }
 
-    return 1;
+        if (!b || (b = find_open(gb, t, 1, 0, gb->bi_n, b - 1, &depth))
+                == gb->bi_n)
+            return 1; /* Not found. */
+
+        i = (b + 1) * BRACE_BLOCK;
+    }
 }
 
 /* ######################################################################## */
@@ -794,78 +2429,168 @@ error:
     return 1;
 }
 
-int gb_trim_clean(Gap_buf gb)
+static int trim_ch(struct trim *t, char ch)
 {
-    size_t g_orig;
-    int at_end_of_buffer, delete_nl, at_end_of_line;
-    char ch;
+    /* Returns 1 if the character is deleted. */
+    if (isgraph((unsigned char) ch)) {
+        /* These characters are never deleted. */
+        t->at_end_of_buffer = 0;
+        t->at_end_of_line = 0;
+    } else if (ch == '\n') {
+        t->at_end_of_line = 1;
+        if (t->at_end_of_buffer) {
+            /*
+             * Do not delete the first encountered new line but delete all
+             * trailing ones after that.
+             */
+            if (t->delete_nl)
+                return 1;
+
+            t->delete_nl = 1;
+        }
+    } else if (ch == ' ' || ch == '\t') {
+        /* Trim trailing whitespace from the end of lines. */
+        return t->at_end_of_line;
+    } else {
+        /* Clean: Delete all other characters. */
+        return 1;
+    }
+
+    return 0;
+}
 
-    /* Record starting location. */
-    g_orig = gb->g;
+static void trim_run(Gap_buf gb, struct trim *t, size_t i, size_t g, size_t n)
+{
+    /* Records the deletion of the n characters at index i, which is at g. */
+    struct operation op;
 
-    gb_end_of_buffer(gb);
+    if (!n)
+        return;
 
-    if (record_multi(gb, BEGIN_MULTI))
-        debug(return 1);
+    ++t->runs;
+    t->num += n;
 
-    at_end_of_buffer = 1;
-    delete_nl = 0;
-    at_end_of_line = 0;
+    if (t->apply) {
+        op.g = g;
+        op.n = n;
+        op.type = DELETE;
 
-    while (!gb_left_ch(gb)) {
-        ch = *(gb->a + gb->c);
+        /* Cannot fail, as the memory has been reserved. */
+        push_n(record_text(gb), gb->a + i, n);
+        push(record_buf(gb), &op);
+    }
+}
+
+static void trim_span(Gap_buf gb, struct trim *t, size_t s, size_t n, size_t g)
+{
+    /*
+     * Scans the n characters at index s backwards, where the first one is
+     * at g. When applying, the kept characters are moved up to the end of
+     * the text, and the line index after the gap is rebuilt as they go.
+     * The text of a run is recorded before the next kept character can be
+     * written over it.
+     */
+    size_t i, run_n = 0, d;
+    char ch;
+
+    i = n;
+    while (i) {
+        ch = *(gb->a + s + --i);
+
+        if (trim_ch(t, ch)) {
+            ++run_n;
+            continue;
+        }
+
+        trim_run(gb, t, s + i + 1, g + i + 1, run_n);
+        run_n = 0;
 
-        if (isgraph(ch)) {
-            /* These characters are never deleted. */
-            at_end_of_buffer = 0;
-            at_end_of_line = 0;
-        } else if (ch == '\n') {
-            if (at_end_of_buffer) {
-                /* Trim excess new line characters from the end of the buffer.
-                 */
-                if (delete_nl) {
-                    if (gb_delete_ch(gb))
-                        debug(goto error);
-                } else {
-                    /*
-                     * Do not delete the first encountered new line
-                     * but delete all trailing ones after that.
-                     */
-                    delete_nl = 1;
-                }
+        if (t->apply) {
+            *(gb->a + --t->d) = ch;
+            if (ch == '\n') {
+                d = gb->e - t->d;
+                push(gb->nl_after, &d);
             }
-            at_end_of_line = 1;
-        } else if (ch == ' ' || ch == '\t') {
-            /* Trim trailing whitespace from the end of lines. */
-            if (at_end_of_line && gb_delete_ch(gb))
-                debug(goto error);
-        } else {
-            /* Clean: Delete all other characters. */
-            if (gb_delete_ch(gb))
-                debug(goto error);
         }
     }
 
-    if (record_multi(gb, END_MULTI))
-        debug(return 1);
+    trim_run(gb, t, s, g, run_n);
+}
 
+static void trim_scan(Gap_buf gb, struct trim *t, int apply)
+{
+    /* Scans the text after the gap, then the text before the gap. */
+    t->at_end_of_buffer = 1;
+    t->delete_nl = 0;
+    t->at_end_of_line = 0;
+    t->apply = apply;
+    t->num = 0;
+    t->runs = 0;
+    t->d = gb->e;
+
+    trim_span(gb, t, gb->c, gb->e - gb->c, gb->g);
+    t->num_after = t->num;
+    trim_span(gb, t, 0, gb->g, 0);
+}
+
+int gb_trim_clean(Gap_buf gb)
+{
     /*
-     * Try to travel back to the same starting position,
-     * although it may not be possible due to the deletions.
+     * Trims trailing whitespace and excess trailing newline characters,
+     * and deletes the other non-printable characters. The text is compacted
+     * in one pass, with the kept characters moved up to the end of the text,
+     * leaving the gap at the start. Each run of deleted characters is
+     * recorded as one deletion, from the last run to the first, all in one
+     * group. The cursor keeps its place in the text.
      */
-    while (!gb_right_ch(gb))
-        if (gb->g == g_orig)
-            break;
+    struct trim t;
+    size_t g;
 
-    return 0;
+    clear_sticky_column(gb);
 
-error:
-    if (record_multi(gb, END_MULTI))
+    /* Count first, so that the memory can be reserved. */
+    trim_scan(gb, &t, 0);
+    if (!t.num)
+        return 0;
+
+    if (reserve_buf(record_buf(gb), t.runs + 2)
+        || reserve_buf(record_text(gb), t.num)
+        || reserve_buf(gb->nl_after, buf_num_used_elements(gb->nl_before)))
         debug(return 1);
 
-    /* Attempt undo. */
-    gb_undo(gb);
-    debug(return 1);
+    /* Cannot fail now. */
+
+    record_multi(gb, BEGIN_MULTI);
+
+    if (gb->mode == NORMAL) {
+        truncate_buf(gb->redo);
+        truncate_buf(gb->redo_text);
+    }
+
+    truncate_buf(gb->nl_after);
+    truncate_buf(gb->rows);
+    gb->last.sc = NULL; /* The changes are spread out, so print every row. */
+    gb->bi_stale = 1;
+    g = gb->g;
+    trim_scan(gb, &t, 1);
+
+    /* Deletions before the cursor move it back. */
+    g -= t.num - t.num_after;
+    gb->g = 0;
+    gb->c = t.d;
+    truncate_buf(gb->nl_before);
+
+    record_multi(gb, END_MULTI);
+
+    gb_move_to(gb, g);
+
+    clear_mark(gb);
+
+    update_mod(gb);
+
+    shrink_gap(gb, 0);
+
+    return 0;
 }
 
 /* ######################################################################## */
@@ -874,39 +2599,103 @@ error:
 /* ######################## File related commands  ######################## */
 /* ######################################################################## */
 
+static int file_size(FILE *fp, size_t *size)
+{
+    /* Gets the size of a regular file. Returns 1 if it is not known. */
+#ifdef _WIN32
+    struct _stat64 st;
+
+    if (_fstat64(fileno(fp), &st) || !(st.st_mode & _S_IFREG))
+        return 1;
+#else
+    struct stat st;
+
+    if (fstat(fileno(fp), &st) || !S_ISREG(st.st_mode))
+        return 1;
+#endif
+
+    if (st.st_size < 0)
+        return 1;
+
+    *size = (size_t) st.st_size;
+    if (st.st_size - *size)
+        return 1; /* Does not fit in a size_t. */
+
+    return 0;
+}
+
 int gb_insert_file(Gap_buf gb, const char *fn)
 {
-    Input ip = NULL;
-    int r, ch;
+    /*
+     * Reads the file straight into the gap, without going through
+     * an intermediate buffer. Returns ENOENT if the file does not exist.
+     * The loop also handles files that change size while being read.
+     * The file is not memory mapped, so the buffer cannot change, or fault,
+     * when another process changes or truncates the file. On Linux, a large
+     * file is read into a reservation (see grow_map), so that the gap can
+     * grow later without copying the text.
+     */
+    FILE *fp = NULL;
+    size_t n, size;
+    int sized;
+
+    errno = 0;
+#ifdef _WIN32
+    if (fopen_s(&fp, fn, "rb"))
+#else
+    if ((fp = fopen(fn, "rb")) == NULL)
+#endif
+    {
+        if (errno == ENOENT)
+            return ENOENT;
+
+        debug(return -1);
+    }
 
-    if ((r = init_input_fn(&ip, fn, BLOCKING, RAW, NULL)))
-        return r;
+    sized = !file_size(fp, &size);
 
     if (record_multi(gb, BEGIN_MULTI)) {
-        free_input(ip);
+        fclose(fp);
         debug(return -1);
     }
 
+    /*
+     * Size the gap to fit the whole file, plus one so that the end of the
+     * file is detected by the first read. Then the file is read with one
+     * copy and recorded as one operation.
+     */
+    if (sized && !add_overflow(size, 1) && grow_gap(gb, size + 1))
+        debug(goto error);
+
     while (1) {
-        if (get_ch(ip, &ch))
+        /* The gap grows each time it is filled. */
+        if (grow_gap(gb, 1))
             debug(goto error);
 
-        if (ch == EOF)
-            break;
+        n = fread(gb->a + gb->g, 1, gb->c - gb->g, fp);
 
-        if (gb_insert_ch(gb, (char) ch))
+        if (n && commit_insert(gb, n))
             debug(goto error);
+
+        if (ferror(fp))
+            debug(goto error);
+
+        if (feof(fp))
+            break;
     }
 
     if (record_multi(gb, END_MULTI)) {
-        free_input(ip);
+        fclose(fp);
         debug(return -1);
     }
 
-    return free_input(ip);
+    if (fclose(fp))
+        debug(return -1);
+
+    return 0;
 
 error:
-    free_input(ip);
+    fclose(fp);
 
     if (record_multi(gb, END_MULTI))
         debug(return -1);
@@ -917,21 +2706,41 @@ error:
     debug(return -1);
 }
 
-const char *gb_to_str(Gap_buf gb)
+void gb_spans(Gap_buf gb, const char **before, size_t *before_n,
+    const char **after, size_t *after_n)
 {
-    /* Only safe to use while the gap buffer is not changed. */
-
-    gb_start_of_buffer(gb);
+    /*
+     * Gets the text as two spans, the text before the gap and the text after
+     * it, without changing anything. Either span can be empty. The spans are
+     * only valid while the gap buffer is not changed.
+     */
+    *before = gb->a;
+    *before_n = gb->g;
+    *after = gb->a + gb->c;
+    *after_n = gb->e - gb->c; /* Excludes the end of buffer character. */
+}
 
-    do {
-        if (*(gb->a + gb->c) == '\0')
-            if (gb_delete_ch(gb))
-                debug(return NULL);
-    } while (!gb_right_ch(gb));
+const char *gb_make_contiguous(Gap_buf gb, size_t *n)
+{
+    /*
+     * Moves the gap to the end of the buffer, so that the text is one span,
+     * and terminates it with a '\0' character in the gap. The cursor moves
+     * to the end of the buffer. n is set to the length of the text, if it is
+     * not NULL, as the text may contain '\0' characters. The text is only
+     * valid while the gap buffer is not changed.
+     */
+    if (gb_move_to(gb, gb->g + (gb->e - gb->c)))
+        debug(return NULL);
 
-    if (gb_insert_ch(gb, '\0'))
+    /* Make room for the terminator. */
+    if (gb->g == gb->c && grow_gap(gb, 1))
         debug(return NULL);
 
+    *(gb->a + gb->g) = '\0';
+
+    if (n != NULL)
+        *n = gb->g;
+
     return gb->a;
 }
 
@@ -955,9 +2764,15 @@ int gb_set_fn(Gap_buf gb, const char *fn)
         debug(return 1);
 
     memmove(t, fn, len + 1);
+    free(gb->fn);
     gb->fn = t;
 
-    /* Set mod so that the buffer can be re-saved as a different filename. */
+    /*
+     * Set mod so that the buffer can be re-saved as a different filename.
+     * The last save was to a different file.
+     */
+    gb->save_set = 0;
+    ++gb->save_n;
     gb->mod = 1;
 
     return 0;
@@ -965,7 +2780,17 @@ int gb_set_fn(Gap_buf gb, const char *fn)
 
 void gb_clear_mod(Gap_buf gb)
 {
+    /* Makes the current step the save step. */
+    gb->save = gb->step;
+    gb->save_set = 1;
+    ++gb->save_n;
     gb->mod = 0;
+    gb->merge = 0; /* Do not merge across a save. */
+}
+
+int gb_is_modified(Gap_buf gb)
+{
+    return gb->mod != 0;
 }
 
 int gb_write_file(Gap_buf gb)
@@ -1024,7 +2849,7 @@ int gb_write_file(Gap_buf gb)
         debug(goto error);
 
     free(tmp_fn);
-    gb->mod = 0;
+    gb_clear_mod(gb);
     return 0;
 
 error:
@@ -1036,6 +2861,199 @@ error_no_fclose:
     return 1;
 }
 
+static void drop_newest(Gap_buf gb, size_t k)
+{
+    /*
+     * Removes the k newest steps from the top of the undo buffer, or all of
+     * them when there are fewer. Only used outside of a recording.
+     */
+    struct operation *op;
+    size_t num, i, depth = 0, n = 0, text_n = 0;
+
+    num = buf_num_used_elements(gb->undo);
+    for (i = num; i && n < k; --i) {
+        op = get_buf_element(gb->undo, i - 1);
+        if (op->type == END_MULTI)
+            ++depth;
+        else if (op->type == BEGIN_MULTI)
+            --depth;
+        else if (op->type == DELETE)
+            text_n += op->n;
+
+        if (!depth)
+            ++n;
+    }
+
+    pop_n(gb->undo, NULL, num - i);
+    pop_n(gb->undo_text, NULL, text_n);
+}
+
+static void drop_later_history(Gap_buf gb)
+{
+    /*
+     * Drops the redo history, and the branches and checkpoints after the
+     * current step, as they can no longer be reached.
+     */
+    struct branch **list;
+    size_t num, i, k;
+
+    truncate_buf(gb->redo);
+    truncate_buf(gb->redo_text);
+
+    if ((num = buf_num_used_elements(gb->branches))) {
+        list = get_buf_element(gb->branches, 0);
+        for (i = k = 0; i < num; ++i) {
+            if (list[i]->step > gb->step) {
+                gb->br_s -= branch_size(list[i]);
+                free_branch(list[i]);
+            } else {
+                list[k++] = list[i];
+            }
+        }
+
+        pop_n(gb->branches, NULL, num - k);
+    }
+
+    drop_later_checkpoints(gb);
+
+    if (gb->save_set && gb->save > gb->step)
+        gb->save_set = 0;
+}
+
+static int restore_checkpoint(Gap_buf gb, size_t i)
+{
+    /*
+     * Replaces the text with checkpoint i, and goes back to its step. The
+     * history after that step is dropped. The cursor keeps its position, as
+     * far as the text allows. Returns 1 if there is not enough memory, in
+     * which case nothing is changed.
+     */
+    struct checkpoint cp;
+    size_t len, k, j, nl_b, nl_a, num_b, num_a;
+    const char *last_nl = NULL;
+
+    cp = *(struct checkpoint *) get_buf_element(gb->cps, i);
+
+    len = gb->g + (gb->e - gb->c);
+    k = gb->g < cp.n ? gb->g : cp.n;
+
+    nl_b = count_nl(cp.text, k, &last_nl);
+    nl_a = count_nl(cp.text + k, cp.n - k, &last_nl);
+    num_b = buf_num_used_elements(gb->nl_before);
+    num_a = buf_num_used_elements(gb->nl_after);
+
+    /* Make room for the text and its line index, before changing anything. */
+    if (cp.n > len && grow_gap(gb, cp.n - len))
+        debug(return 1);
+
+    if (reserve_buf(gb->nl_before, nl_b > num_b ? nl_b - num_b : 0))
+        debug(return 1);
+
+    if (reserve_buf(gb->nl_after, nl_a > num_a ? nl_a - num_a : 0))
+        debug(return 1);
+
+    /* Cannot fail now. */
+
+    drop_newest(gb, gb->step - cp.step);
+    gb->step = cp.step;
+    drop_later_history(gb); /* Keeps checkpoint i. */
+
+    /* The text goes around the gap, which is at the cursor. */
+    memcpy(gb->a, cp.text, k);
+    gb->g = k;
+    gb->c = gb->e - (cp.n - k);
+    memcpy(gb->a + gb->c, cp.text + k, cp.n - k);
+
+    truncate_buf(gb->nl_before);
+    for (j = 0; j < k; ++j)
+        if (cp.text[j] == '\n')
+            push(gb->nl_before, &j);
+
+    /* Closest to the gap on top. */
+    truncate_buf(gb->nl_after);
+    for (j = cp.n; j > k; --j)
+        if (cp.text[j - 1] == '\n') {
+            i = gb->e - (gb->c + (j - 1 - k));
+            push(gb->nl_after, &i);
+        }
+
+    clear_mark(gb);
+    clear_sticky_column(gb);
+    gb->merge = 0;
+    gb->d = 0;
+    gb->rc = 1;
+    truncate_buf(gb->rows);
+    gb->last.sc = NULL;
+    gb->dmg = 0;
+    gb->bi_stale = 1;
+
+    update_mod(gb);
+
+    shrink_gap(gb, 0);
+
+    return 0;
+}
+
+int gb_revert(Gap_buf gb)
+{
+    /*
+     * Goes back to the save step. The closest checkpoint at or after the save
+     * step is restored, instead of undoing each step, and then the steps that
+     * are left are undone. The history after the save step is dropped. If the
+     * save step is in the redo history, then it is redone instead. Returns 1
+     * if the save step cannot be reached, in which case nothing is changed.
+     */
+    struct checkpoint *cp;
+    size_t num, i, k = 0, step;
+    int found = 0;
+
+    if (!gb->mod)
+        return 0; /* Nothing to do. */
+
+    if (!gb->save_set || gb->depth)
+        return 1;
+
+    if (gb->save > gb->step) {
+        if (undo_steps(gb, gb->redo, gb->save - gb->step)
+            < gb->save - gb->step)
+            return 1;
+
+        while (gb->step < gb->save)
+            if (gb_redo(gb))
+                debug(return 1);
+
+        return 0;
+    }
+
+    num = buf_num_used_elements(gb->cps);
+    step = gb->step;
+    for (i = 0; i < num; ++i) {
+        cp = get_buf_element(gb->cps, i);
+        if (cp->step >= gb->save && cp->step < step) {
+            step = cp->step;
+            k = i;
+            found = 1;
+        }
+    }
+
+    /* The steps from the checkpoint back to the save step are undone. */
+    if (step > gb->save
+        && undo_steps(gb, gb->undo, gb->step - gb->save)
+            < gb->step - gb->save)
+        return 1;
+
+    if (found && restore_checkpoint(gb, k))
+        debug(return 1);
+
+    while (gb->step > gb->save)
+        if (gb_undo(gb))
+            debug(return 1);
+
+    drop_later_history(gb);
+
+    return 0;
+}
+
 /* ######################################################################## */
 
 /* ######################################################################## */
@@ -1063,7 +3081,6 @@ static int gb_copy_or_cut_region(Gap_buf gb, Gap_buf paste, int type)
     size_t i_start; /* Index of the start of the region (inclusive). */
     size_t i_end;   /* Index of the end of the region (exclusive). */
     size_t region_size;
-    size_t i;
 
     if (!gb->m_set)
         return 1;
@@ -1085,39 +3102,21 @@ static int gb_copy_or_cut_region(Gap_buf gb, Gap_buf paste, int type)
 
     region_size = i_end - i_start;
 
-    for (i = i_start; i < i_end; ++i)
-        if (gb_insert_ch(paste, *(gb->a + i)))
-            debug(return 1);
+    if (gb_insert_mem(paste, gb->a + i_start, region_size))
+        debug(return 1);
 
     if (type == CUT_REGION) {
-        if (record_multi(gb, BEGIN_MULTI))
+        /* Move to the start of the region. */
+        if (gb->m < gb->g && gb_move_to(gb, gb->m))
             debug(return 1);
 
-        if (gb->m < gb->g) {
-            for (i = 0; i < region_size; ++i)
-                if (gb_backspace_ch(gb))
-                    debug(goto error);
-        } else {
-            for (i = 0; i < region_size; ++i)
-                if (gb_delete_ch(gb))
-                    debug(goto error);
-        }
-
-        if (record_multi(gb, END_MULTI))
+        if (gb_delete_mem(gb, region_size))
             debug(return 1);
     } else {
         clear_mark(gb);
     }
 
     return 0;
-
-error:
-    if (record_multi(gb, END_MULTI))
-        debug(return 1);
-
-    /* Attempt undo. */
-    gb_undo(gb);
-    debug(return 1);
 }
 
 int gb_copy_region(Gap_buf gb, Gap_buf paste)
@@ -1150,34 +3149,27 @@ int gb_cut_to_end_of_line(Gap_buf gb, Gap_buf paste)
 
 int gb_insert_gb(Gap_buf target, Gap_buf source)
 {
-    /* Inserts source into target. */
-    size_t i;
+    /* Inserts source into target as one operation. */
+    size_t before, after;
 
-    if (record_multi(target, BEGIN_MULTI))
-        debug(return 1);
+    before = source->g;
+    after = source->e - source->c;
 
-    /* Before gap. */
-    for (i = 0; i < source->g; ++i)
-        if (gb_insert_ch(target, *(source->a + i)))
-            debug(goto error);
+    clear_sticky_column(target);
 
-    /* After gap. */
-    for (i = source->c; i < source->e; ++i)
-        if (gb_insert_ch(target, *(source->a + i)))
-            debug(goto error);
+    if (!before && !after)
+        return 0;
 
-    if (record_multi(target, END_MULTI))
+    if (add_overflow(before, after) || grow_gap(target, before + after))
         debug(return 1);
 
-    return 0;
+    /* Before gap. */
+    memcpy(target->a + target->g, source->a, before);
 
-error:
-    if (record_multi(target, END_MULTI))
-        debug(return 1);
+    /* After gap. */
+    memcpy(target->a + target->g + before, source->a + source->c, after);
 
-    /* Attempt undo. */
-    gb_undo(target);
-    debug(return 1);
+    return commit_insert(target, before + after);
 }
 
 /* ######################################################################## */
@@ -1208,6 +3200,314 @@ void gb_request_centring(Gap_buf gb)
     gb->rc = 1;
 }
 
+static char char_at(Gap_buf gb, size_t i)
+{
+    /* Returns the character at the g-value i. The end of buffer is '~'. */
+    if (i < gb->g)
+        return *(gb->a + i);
+
+    return *(gb->a + gb->c + (i - gb->g));
+}
+
+static size_t ch_size(char ch)
+{
+    /* The number of screen positions used by a character, bar newline. */
+    if (ch == '\t')
+        return TAB_SIZE;
+
+    if (iscntrl((unsigned char) ch))
+        return CTRL_CH_SIZE;
+
+    return 1; /* Printable, or printed as '?'. */
+}
+
+static int fill_rows(Gap_buf gb)
+{
+    /*
+     * Simulates printing forwards from the last cached row, adding the rows
+     * that follow until there is one past the bottom of the text area, or
+     * until the end of the buffer. So it only visits the text on the screen.
+     */
+    struct row row;
+    size_t n, len, i, k, x, size, left;
+    char ch;
+
+    if (!(n = buf_num_used_elements(gb->rows)))
+        debug(return 1);
+
+    len = gb->g + (gb->e - gb->c);
+    row = *(struct row *) get_buf_element(gb->rows, n - 1);
+    i = row.g;
+    k = row.k;
+    x = 0;
+
+    while (n <= gb->rows_h && i <= len) {
+        ch = char_at(gb, i);
+
+        if (ch == '\n') {
+            /* The rest of the row is cleared. */
+            row.g = i + 1;
+            row.k = 0;
+            if (push(gb->rows, &row))
+                debug(return 1);
+
+            ++n;
+            x = 0;
+            ++i;
+            continue;
+        }
+
+        size = ch_size(ch);
+        left = size - k;
+        k = 0;
+
+        /* Wrap, possibly more than once. */
+        while (left && x + left >= gb->rows_w) {
+            left -= gb->rows_w - x;
+            x = 0;
+
+            if (left) {
+                row.g = i;
+                row.k = size - left;
+            } else {
+                if (i == len)
+                    return 0; /* The end of buffer character fills the row. */
+
+                row.g = i + 1;
+                row.k = 0;
+            }
+
+            if (push(gb->rows, &row))
+                debug(return 1);
+
+            if (++n > gb->rows_h)
+                return 0;
+        }
+
+        x += left;
+        ++i;
+    }
+
+    return 0;
+}
+
+static int set_rows(Gap_buf gb, size_t h, size_t w)
+{
+    /*
+     * Makes sure that the cached rows are for an h by w text area and start
+     * from the draw start, then fills them. Returns 1 on failure, in which
+     * case the cache is emptied.
+     */
+    struct row row;
+    size_t n;
+
+    n = buf_num_used_elements(gb->rows);
+    if (h != gb->rows_h || w != gb->rows_w || !n
+        || ((struct row *) get_buf_element(gb->rows, 0))->g != gb->d) {
+        truncate_buf(gb->rows);
+        gb->rows_h = h;
+        gb->rows_w = w;
+        row.g = gb->d;
+        row.k = 0;
+        if (push(gb->rows, &row))
+            debug(return 1);
+    }
+
+    if (fill_rows(gb)) {
+        truncate_buf(gb->rows);
+        debug(return 1);
+    }
+
+    return 0;
+}
+
+static size_t row_g(Gap_buf gb, size_t r)
+{
+    /* Returns the first character that starts on a cached row. */
+    struct row *row;
+    size_t len;
+
+    row = get_buf_element(gb->rows, r);
+    len = gb->g + (gb->e - gb->c);
+
+    if (row->k && row->g < len)
+        return row->g + 1;
+
+    return row->g;
+}
+
+static int cursor_on_rows(Gap_buf gb)
+{
+    /*
+     * Returns 1 if the cursor is on one of the filled rows. If there is no
+     * row past the bottom, then the end of the buffer is on the screen.
+     */
+    if (gb->g < gb->d)
+        return 0;
+
+    if (buf_num_used_elements(gb->rows) <= gb->rows_h)
+        return 1;
+
+    return gb->g < row_g(gb, gb->rows_h);
+}
+
+static size_t cursor_screen_row(Gap_buf gb)
+{
+    /* Returns the row of the cursor, which must be on the filled rows. */
+    size_t n, r;
+
+    n = buf_num_used_elements(gb->rows);
+    if (n > gb->rows_h)
+        n = gb->rows_h;
+
+    for (r = 1; r < n; ++r)
+        if (row_g(gb, r) > gb->g)
+            break;
+
+    return r - 1;
+}
+
+static size_t row_above(Gap_buf gb, size_t i)
+{
+    /*
+     * Returns the start of the row above the row that starts at i, by
+     * wrapping backwards. Like centring, this is an estimate for a line that
+     * wraps, as the rows of a line are really counted from its start.
+     */
+    size_t x = 0, size;
+    char ch;
+
+    /* A newline character ends the row above, and is a part of it. */
+    if (i && char_at(gb, i - 1) == '\n') {
+        --i;
+        x = 1;
+    }
+
+    while (i) {
+        ch = char_at(gb, i - 1);
+        if (ch == '\n')
+            break;
+
+        size = ch_size(ch);
+        if (x && x + size > gb->rows_w)
+            break;
+
+        x += size;
+        --i;
+    }
+
+    return i;
+}
+
+static int scroll_down(Gap_buf gb, size_t n, int keep_row)
+{
+    /*
+     * Scrolls down by n rows, using the rows of the last print. If keep_row
+     * is set, then the cursor moves to the start of the same row of the
+     * screen. Otherwise, it only moves if it would be off the screen.
+     * Returns 1 if the end of the buffer is already on the screen.
+     */
+    size_t r, i, num;
+
+    if (!gb->rows_h || set_rows(gb, gb->rows_h, gb->rows_w)
+        || !cursor_on_rows(gb))
+        return 1;
+
+    num = buf_num_used_elements(gb->rows);
+    if (num <= gb->rows_h)
+        return 1;
+
+    r = cursor_screen_row(gb);
+
+    /* The draw start must be the start of a character. */
+    for (i = n; i < num && ((struct row *) get_buf_element(gb->rows, i))->k;
+        ++i)
+        ;
+
+    if (i == num)
+        return 1;
+
+    /* The rows below the new draw start are still correct. */
+    gb->d = ((struct row *) get_buf_element(gb->rows, i))->g;
+    pop_bottom_n(gb->rows, NULL, i);
+
+    if (set_rows(gb, gb->rows_h, gb->rows_w))
+        debug(return 1);
+
+    if (!keep_row) {
+        if (gb->g >= gb->d)
+            return 0;
+
+        r = 0;
+    }
+
+    num = buf_num_used_elements(gb->rows);
+    if (r >= num)
+        r = num - 1;
+
+    return gb_move_to(gb, ((struct row *) get_buf_element(gb->rows, r))->g);
+}
+
+static int scroll_up(Gap_buf gb, size_t n, int keep_row)
+{
+    /*
+     * Scrolls up by n rows. If keep_row is set, then the cursor moves to the
+     * start of the same row of the screen. Otherwise, it only moves if it
+     * would be off the screen. Returns 1 if already at the top.
+     */
+    size_t r, num;
+
+    if (!gb->rows_h || set_rows(gb, gb->rows_h, gb->rows_w)
+        || !cursor_on_rows(gb) || !gb->d)
+        return 1;
+
+    r = cursor_screen_row(gb);
+
+    while (n-- && gb->d)
+        gb->d = row_above(gb, gb->d);
+
+    if (set_rows(gb, gb->rows_h, gb->rows_w))
+        debug(return 1);
+
+    num = buf_num_used_elements(gb->rows);
+    if (!keep_row) {
+        if (cursor_on_rows(gb))
+            return 0;
+
+        /* The last row on the screen. */
+        r = gb->rows_h - 1;
+    }
+
+    if (r >= num)
+        r = num - 1;
+
+    return gb_move_to(gb, ((struct row *) get_buf_element(gb->rows, r))->g);
+}
+
+int gb_page_down(Gap_buf gb)
+{
+    /* Scrolls down a screen, less one row to keep some context. */
+    return scroll_down(gb, gb->rows_h > 1 ? gb->rows_h - 1 : 1, 1);
+}
+
+int gb_page_up(Gap_buf gb)
+{
+    /* Scrolls up a screen, less one row to keep some context. */
+    return scroll_up(gb, gb->rows_h > 1 ? gb->rows_h - 1 : 1, 1);
+}
+
+int gb_scroll_down(Gap_buf gb)
+{
+    /* Scrolls down one row. */
+    return scroll_down(gb, 1, 0);
+}
+
+int gb_scroll_up(Gap_buf gb)
+{
+    /* Scrolls up one row. */
+    return scroll_up(gb, 1, 0);
+}
+
 #define check()                                                               \
     do {                                                                      \
         ++x;                                                                  \
@@ -1266,6 +3566,13 @@ static int gb_centre(Gap_buf gb, size_t sub_h, size_t sub_w)
      * so the area check is a good short-circuit for when the cursor is
      * far off the screen below.
      */
+    /*
+     * The cached rows from the last print show if the cursor is still on the
+     * screen, which saves simulating printing backwards from the cursor.
+     */
+    if (!gb->rc && !set_rows(gb, sub_h, sub_w) && cursor_on_rows(gb))
+        return 0;
+
     if (gb->g < gb->d || gb->g - gb->d > sub_h * sub_w)
         gb->rc = 1;
 
@@ -1313,12 +3620,188 @@ end:
 
 #undef check
 
+static struct row print_row(Buf rows, size_t r, size_t len)
+{
+    /* Returns row r, or the end of the text when the rows stop before it. */
+    struct row row;
+
+    if (r < buf_num_used_elements(rows))
+        return *(struct row *) get_buf_element(rows, r);
+
+    row.g = len + 1;
+    row.k = 0;
+    return row;
+}
+
+static int rows_kept(Gap_buf gb, struct print *pr, size_t r, size_t e,
+    size_t cs, size_t ce)
+{
+    /*
+     * Returns 1 if rows r to e are still on the screen as the last print left
+     * them, and would be printed the same way again. Row r starts with a whole
+     * character, and the rows after it, up to e, continue a long character.
+     * The highlighting of the text from cs to ce has changed.
+     */
+    struct row s, t, ls, lt;
+    size_t i;
+
+    for (i = r; i <= e && i < pr->h; ++i)
+        if (*(size_t *) get_buf_element(gb->last_stamps, i)
+            != get_row_stamp(pr->sc, pr->y + i, pr->x, pr->w))
+            return 0; /* Written to by something else. */
+
+    /* Rows past the end of the text are blank. */
+    if (r >= buf_num_used_elements(gb->rows))
+        return r >= buf_num_used_elements(gb->last_rows);
+
+    if (r >= buf_num_used_elements(gb->last_rows))
+        return 0;
+
+    s = print_row(gb->rows, r, pr->len);
+    t = print_row(gb->rows, e + 1, pr->len);
+    ls = print_row(gb->last_rows, r, gb->last.len);
+    lt = print_row(gb->last_rows, e + 1, gb->last.len);
+
+    /* The cursor is always printed, to find where it is on the screen. */
+    if (s.g <= gb->g && gb->g < t.g)
+        return 0;
+
+    if (s.g < ce && t.g > cs)
+        return 0;
+
+    if (ls.k || lt.k)
+        return 0;
+
+    if (!gb->dmg)
+        return ls.g == s.g && lt.g == t.g;
+
+    /* The text of the rows must be unchanged, and moved as a whole. */
+    if (ls.g < gb->dmg_oe && lt.g >= gb->dmg_s)
+        return 0;
+
+    if (lt.g < gb->dmg_s)
+        return ls.g == s.g && lt.g == t.g;
+
+    return ls.g - gb->dmg_oe + gb->dmg_e == s.g
+        && lt.g - gb->dmg_oe + gb->dmg_e == t.g;
+}
+
+static int print_span(Gap_buf gb, struct print *pr, size_t s, size_t t)
+{
+    /*
+     * Prints the text from s to t, split at the gap and at the edges of the
+     * highlighted text. Returns 1 once the text area is full.
+     */
+    size_t b;
+    int full;
+
+    while (s < t) {
+        b = t;
+        if (s < gb->g && gb->g < b)
+            b = gb->g;
+
+        if (s < pr->hs) {
+            if (pr->hs < b)
+                b = pr->hs;
+        } else if (s < pr->he) {
+            if (pr->he < b)
+                b = pr->he;
+
+            highlight_on(pr->sc);
+        }
+
+        full = sub_screen_print_mem(pr->sc, pr->y, pr->x, pr->h, pr->w,
+            s < gb->g ? gb->a + s : gb->a + gb->c + (s - gb->g), b - s);
+        highlight_off(pr->sc);
+        if (full)
+            return 1;
+
+        s = b;
+    }
+
+    return 0;
+}
+
+static int print_rows(Gap_buf gb, struct print *pr, size_t r, size_t e,
+    size_t *cursor_y, size_t *cursor_x)
+{
+    /*
+     * Clears rows r to e and prints their text. If the cursor is on them,
+     * then its location on the screen is recorded.
+     */
+    struct row s, t;
+
+    if (soft_clear_sub_screen(pr->sc, pr->y + r, pr->x,
+            (e < pr->h ? e + 1 : pr->h) - r, pr->w))
+        debug(return 1);
+
+    if (r >= buf_num_used_elements(gb->rows))
+        return 0;
+
+    s = print_row(gb->rows, r, pr->len);
+    t = print_row(gb->rows, e + 1, pr->len);
+
+    if (move(pr->sc, pr->y + r, pr->x))
+        debug(return 1);
+
+    if (s.g <= gb->g && gb->g < t.g) {
+        print_span(gb, pr, s.g, gb->g);
+
+        *cursor_y = get_y(pr->sc);
+        *cursor_x = get_x(pr->sc);
+
+        /* Cursor out of designated sub-screen text area. */
+        if (*cursor_y >= pr->y + pr->h || *cursor_x >= pr->x + pr->w)
+            debug(return 1);
+
+        s.g = gb->g;
+    }
+
+    /* Failure is OK, as printing stops once the text area is full. */
+    print_span(gb, pr, s.g, t.g);
+
+    return 0;
+}
+
+int gb_lay_out(Gap_buf gb, size_t h, size_t w, size_t *top)
+{
+    /*
+     * Lays out the rows of an h by w text area, as a print does, without
+     * printing them. The paging and scrolling commands use these rows. The
+     * first character on the text area is stored in top. Returns 1 if the
+     * cursor is not on the rows.
+     */
+    if (!h || !w)
+        debug(return 1);
+
+    if (gb_centre(gb, h, w))
+        debug(return 1);
+
+    if (set_rows(gb, h, w))
+        debug(return 1);
+
+    if (!cursor_on_rows(gb))
+        debug(return 1);
+
+    *top = gb->d;
+
+    return 0;
+}
+
 int gb_print(Gap_buf gb, Screen sc, size_t y_origin, size_t x_origin,
     size_t sub_h, size_t sub_w, int sb_option, size_t *cursor_y,
     size_t *cursor_x)
 {
+    /*
+     * Prints the text a block of rows at a time. A block is a row that starts
+     * with a whole character, and the rows that continue a long character
+     * from it. Blocks that the last print left on the screen, and that would
+     * be printed the same way, are skipped.
+     */
     char *t;
-    size_t h, w, text_h, i, y, x;
+    size_t h, w, text_h, top, n, r, e, cs, ce, stamp, y = 0, x = 0;
+    struct print pr;
+    int same;
 
     if (sb_option != INCLUDE_STATUS_BAR && sb_option != EXCLUDE_STATUS_BAR)
         debug(return 1);
@@ -1344,73 +3827,79 @@ int gb_print(Gap_buf gb, Screen sc, size_t y_origin, size_t x_origin,
         text_h = sub_h;
 
     /* Minus one for the status bar. */
-    if (gb_centre(gb, text_h, sub_w))
+    if (gb_lay_out(gb, text_h, sub_w, &top))
         debug(return 1);
 
-    /* Place cursor at the left-hand side of the starting row. */
-    if (move(sc, y_origin, x_origin))
-        debug(return 1);
+    pr.sc = sc;
+    pr.y = y_origin;
+    pr.x = x_origin;
+    pr.h = text_h;
+    pr.w = sub_w;
+    pr.len = gb->g + (gb->e - gb->c);
 
-    /* Print before the gap. */
-    i = gb->d;
+    /* The region, bar the cursor, which is always printed without it. */
+    pr.hs = 0;
+    pr.he = 0;
     if (gb->m_set && gb->m < gb->g) {
-        /* Before the region. */
-        for (; i < gb->m; ++i)
-            if (sub_screen_print_ch(
-                    sc, y_origin, x_origin, text_h, sub_w, *(gb->a + i)))
-                debug(return 1);
-
-        highlight_on(sc);
+        pr.hs = gb->m;
+        pr.he = gb->g;
+    } else if (gb->m_set && gb->m > gb->g) {
+        pr.hs = gb->g + 1;
+        pr.he = gb->m;
     }
 
-    for (; i < gb->g; ++i)
-        if (sub_screen_print_ch(
-                sc, y_origin, x_origin, text_h, sub_w, *(gb->a + i)))
-            debug(return 1);
-
-    if (gb->m_set && gb->m < gb->g)
-        highlight_off(sc);
-
-    /* Record location on the screen where the cursor should be. */
-    y = get_y(sc);
-    x = get_x(sc);
-
-    /* Cursor out of designated sub-screen text area. */
-    if (y >= y_origin + text_h || x >= x_origin + sub_w)
-        debug(return 1);
-
-    /* Print after the gap. */
+    same = gb->last.sc == sc && gb->last.y == y_origin
+        && gb->last.x == x_origin && gb->last.h == text_h
+        && gb->last.w == sub_w;
+
+    /* The text where the highlighting changed, from cs to ce. */
+    if (gb->last.hs == gb->last.he) {
+        cs = pr.hs;
+        ce = pr.he;
+    } else if (gb->dmg) {
+        cs = 0; /* The last region has moved, so print every row. */
+        ce = pr.len + 1;
+    } else if (pr.hs == pr.he) {
+        cs = gb->last.hs;
+        ce = gb->last.he;
+    } else if (pr.hs == gb->last.hs) {
+        cs = pr.he < gb->last.he ? pr.he : gb->last.he;
+        ce = pr.he > gb->last.he ? pr.he : gb->last.he;
+    } else if (pr.he == gb->last.he) {
+        cs = pr.hs < gb->last.hs ? pr.hs : gb->last.hs;
+        ce = pr.hs > gb->last.hs ? pr.hs : gb->last.hs;
+    } else {
+        cs = pr.hs < gb->last.hs ? pr.hs : gb->last.hs;
+        ce = pr.he > gb->last.he ? pr.he : gb->last.he;
+    }
 
-    i = gb->c;
-    /*
-     * Print the cursor, always without highlighting.
-     * Failure is OK, as only the first char of a multi-byte character,
-     * or a newline char which is printed as a sequence of space chars
-     * until the edge of the screen, needs to be on the screen.
-     */
-    sub_screen_print_ch(sc, y_origin, x_origin, text_h, sub_w, *(gb->a + i));
+    n = buf_num_used_elements(gb->rows);
+    for (r = 0; r < text_h; r = e + 1) {
+        for (e = r; e + 1 < n
+             && ((struct row *) get_buf_element(gb->rows, e + 1))->k;
+             ++e)
+            ;
 
-    ++i;
+        if (!same || !rows_kept(gb, &pr, r, e, cs, ce))
+            if (print_rows(gb, &pr, r, e, &y, &x))
+                debug(return 1);
+    }
 
-    /* Region. */
-    if (gb->m_set && gb->m > gb->g) {
-        highlight_on(sc);
-        /*
-         * m must be compared to g.
-         * Failure is OK, as cursor has been printed.
-         */
-        for (; i < gb->c + (gb->m - gb->g); ++i)
-            sub_screen_print_ch(
-                sc, y_origin, x_origin, text_h, sub_w, *(gb->a + i));
+    /* Keep this print, for the next one to compare with. */
+    gb->last.sc = NULL;
+    gb->dmg = 0;
+    truncate_buf(gb->last_rows);
+    truncate_buf(gb->last_stamps);
+    if (!push_n(gb->last_rows, get_buf_element(gb->rows, 0), n)
+        && !reserve_buf(gb->last_stamps, text_h)) {
+        for (r = 0; r < text_h; ++r) {
+            stamp = get_row_stamp(sc, y_origin + r, x_origin, sub_w);
+            push(gb->last_stamps, &stamp);
+        }
 
-        highlight_off(sc);
+        gb->last = pr;
     }
 
-    /* Failure is OK. */
-    for (; i <= gb->e; ++i)
-        sub_screen_print_ch(
-            sc, y_origin, x_origin, text_h, sub_w, *(gb->a + i));
-
     if (add_overflow(sub_w, 1))
         debug(return 1);
 
@@ -1426,8 +3915,8 @@ int gb_print(Gap_buf gb, Screen sc, size_t y_origin, size_t x_origin,
     if (sb_option == INCLUDE_STATUS_BAR) {
         /* Prepare status bar. */
         snprintf(gb->sb, gb->sb_s, "%c %s (%" lu ", %" lu ") %02X\n",
-            gb->mod ? '*' : ' ', gb->fn == NULL ? "NULL" : gb->fn, gb->row,
-            gb->col, *(gb->a + gb->c));
+            gb->mod ? '*' : ' ', gb->fn == NULL ? "NULL" : gb->fn,
+            cursor_row(gb), cursor_col(gb), *(gb->a + gb->c));
 
         if (move(sc, y_origin + text_h, x_origin))
             debug(return 1);
@@ -28,6 +28,7 @@
 
 #include <stddef.h>
 
+#include "regex.h"
 #include "screen.h"
 
 #define INCLUDE_STATUS_BAR 1
@@ -38,22 +39,42 @@ typedef struct gap_buf *Gap_buf;
 /* Function declarations */
 void gb_free(Gap_buf gb);
 
+void gb_compact(Gap_buf gb);
+
 void gb_reset(Gap_buf gb);
 
 Gap_buf gb_init(size_t init_num_elements);
 
+int gb_insert_mem(Gap_buf gb, const char *mem, size_t n);
+
 int gb_insert_ch(Gap_buf gb, char ch);
 
+int gb_delete_mem(Gap_buf gb, size_t n);
+
 int gb_delete_ch(Gap_buf gb);
 
 int gb_left_ch(Gap_buf gb);
 
 int gb_right_ch(Gap_buf gb);
 
+int gb_move_to(Gap_buf gb, size_t g);
+
+int gb_line_start(Gap_buf gb, size_t row, size_t *g);
+
+int gb_goto_line(Gap_buf gb, size_t row);
+
 int gb_undo(Gap_buf gb);
 
 int gb_redo(Gap_buf gb);
 
+int gb_switch_branch(Gap_buf gb);
+
+void gb_set_undo_limit(Gap_buf gb, size_t limit);
+
+size_t gb_undo_size(Gap_buf gb);
+
+int gb_drop_oldest_undo(Gap_buf gb);
+
 void gb_start_of_line(Gap_buf gb);
 
 void gb_end_of_line(Gap_buf gb);
@@ -66,7 +87,11 @@ int gb_up_line(Gap_buf gb);
 
 int gb_down_line(Gap_buf gb);
 
-int gb_forward_search(Gap_buf gb, Gap_buf search);
+int gb_forward_search(Gap_buf gb, Gap_buf search, int icase);
+
+int gb_backward_search(Gap_buf gb, Gap_buf search, int icase);
+
+int gb_regex_search(Gap_buf gb, Regex re);
 
 int gb_match_brace(Gap_buf gb);
 
@@ -78,14 +103,21 @@ int gb_trim_clean(Gap_buf gb);
 
 int gb_insert_file(Gap_buf gb, const char *fn);
 
-const char *gb_to_str(Gap_buf gb);
+void gb_spans(Gap_buf gb, const char **before, size_t *before_n,
+    const char **after, size_t *after_n);
+
+const char *gb_make_contiguous(Gap_buf gb, size_t *n);
 
 int gb_set_fn(Gap_buf gb, const char *fn);
 
 void gb_clear_mod(Gap_buf gb);
 
+int gb_is_modified(Gap_buf gb);
+
 int gb_write_file(Gap_buf gb);
 
+int gb_revert(Gap_buf gb);
+
 void gb_set_mark(Gap_buf gb);
 
 void gb_clear_mark(Gap_buf gb);
@@ -106,6 +138,16 @@ void gb_debug_print(Gap_buf gb);
 
 void gb_request_centring(Gap_buf gb);
 
+int gb_page_down(Gap_buf gb);
+
+int gb_page_up(Gap_buf gb);
+
+int gb_scroll_down(Gap_buf gb);
+
+int gb_scroll_up(Gap_buf gb);
+
+int gb_lay_out(Gap_buf gb, size_t h, size_t w, size_t *top);
+
 int gb_print(Gap_buf gb, Screen sc, size_t y_origin, size_t x_origin,
     size_t sub_h, size_t sub_w, int sb_option, size_t *cursor_y,
     size_t *cursor_x);
@@ -26,9 +26,59 @@
 #include "memmem.h"
 #include <limits.h>
 #include <stdint.h>
+#include <string.h>
 
-void *memmem(
-    const void *big, size_t big_size, const void *small, size_t small_size)
+/*
+ * SIMD kernels are used on x86-64, where SSE2 is always available. AVX2 is
+ * used when the CPU supports it.
+ */
+#if defined(__x86_64__) || defined(_M_X64)
+#define SIMD_SEARCH
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define AVX2_TARGET
+#else
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+/*
+ * Case folding tables, which are filled in on the first search. `fold' maps
+ * the ASCII upper case letters to lower case, and `same' maps every character
+ * to itself. Comparing through one or the other lets the kernels share the
+ * same code for both kinds of search.
+ */
+static unsigned char fold[UCHAR_MAX + 1];
+static unsigned char same[UCHAR_MAX + 1];
+
+static int equal(
+    const unsigned char *x, const unsigned char *y, size_t n, int icase)
+{
+    /* Compares n characters, ignoring case if icase is set. */
+    if (!icase)
+        return !memcmp(x, y, n);
+
+    while (n--)
+        if (fold[*x++] != fold[*y++])
+            return 0;
+
+    return 1;
+}
+
+static void fold_jumps(size_t *jump)
+{
+    /*
+     * The jumps were set using lower case characters, so copy them to the
+     * upper case characters that fold onto them.
+     */
+    size_t i;
+
+    for (i = 0; i < UCHAR_MAX + 1; ++i) jump[i] = jump[fold[i]];
+}
+
+static void *quick_search(const void *big, size_t big_size, const void *small,
+    size_t small_size, int icase)
 {
     /*
      * Searches for an exact match of `small' inside of `big'
@@ -41,6 +91,9 @@ void *memmem(
      *
      * This is a fantastic algorithm that is fast and easy to implement.
      * Thank you!
+     *
+     * When icase is set, the characters are compared through the folding
+     * table, so upper and lower case letters match.
      */
 
     size_t jump[UCHAR_MAX + 1];
@@ -66,6 +119,9 @@ void *memmem(
 
     const unsigned char *p_end; /* End of `small' (exclusive). */
 
+    /* Folding table used for comparisons. */
+    const unsigned char *f = icase ? fold : same;
+
     unsigned char u;
     size_t i;
 
@@ -85,7 +141,7 @@ void *memmem(
     if (small_size == SIZE_MAX) {
         /* Special case. Just check for an exact match. */
         for (i = 0; i < small_size; ++i)
-            if (*(b + i) != *(p + i))
+            if (f[*(b + i)] != f[*(p + i)])
                 break;
 
         if (i == small_size)
@@ -96,10 +152,10 @@ void *memmem(
 
     if (small_size == 1) {
         /* Special case. Just search for the character. */
-        u = *p;
+        u = f[*p];
 
         while (b < b_end)
-            if (*b++ == u)
+            if (f[*b++] == u)
                 return (void *) --b; /* Decrement to undo the increment. */
 
         return NULL;
@@ -119,7 +175,10 @@ void *memmem(
      * in `small.' Conversely, if a character only appears in the first
      * position of `small', then it will have a jump of small_size.
      */
-    for (i = 0; i < small_size; ++i) jump[*(p + i)] = small_size - i;
+    for (i = 0; i < small_size; ++i) jump[f[*(p + i)]] = small_size - i;
+
+    if (icase)
+        fold_jumps(jump);
 
     /* Keep looping while `small' could possibly fit. */
     while (b <= b_max) {
@@ -127,9 +186,10 @@ void *memmem(
         /* Check for match. */
         b_check = b;
         p_check = p;
-        while (p_check < p_end)
-            if (*p_check++ != *b_check++)
-                break;
+        while (p_check < p_end && f[*p_check] == f[*b_check]) {
+            ++p_check;
+            ++b_check;
+        }
 
         if (p_check == p_end)
             return (void *) b; /* Match. */
@@ -145,3 +205,404 @@ void *memmem(
 
     return NULL; /* Reached the end and no match. */
 }
+
+static void *reverse_quick_search(const void *big, size_t big_size,
+    const void *small, size_t small_size, int icase)
+{
+    /*
+     * Searches for the last exact match of `small' inside of `big'. This is
+     * the Quick Search run from the end of `big', where the jump is decided
+     * by the character just before the candidate position.
+     */
+    size_t jump[UCHAR_MAX + 1];
+    const unsigned char *b = big;
+    const unsigned char *p = small;
+    const unsigned char *f = icase ? fold : same;
+    size_t i, pos;
+
+    if (small_size > big_size)
+        return NULL;
+
+    if (!small_size)
+        return (void *) (b + big_size);
+
+    if (small_size == 1) {
+        /* Special case. Just search backwards for the character. */
+        for (i = big_size; i--;)
+            if (f[b[i]] == f[*p])
+                return (void *) (b + i);
+
+        return NULL;
+    }
+
+    /*
+     * The closer a character appears to the start of `small', the smaller
+     * the jump. Characters that are not in `small' jump past it.
+     */
+    for (i = 0; i < UCHAR_MAX + 1; ++i) jump[i] = small_size + 1;
+
+    for (i = small_size; i--;) jump[f[p[i]]] = i + 1;
+
+    if (icase)
+        fold_jumps(jump);
+
+    pos = big_size - small_size;
+    while (1) {
+        if (equal(b + pos, p, small_size, icase))
+            return (void *) (b + pos); /* Match. */
+
+        if (!pos || jump[b[pos - 1]] > pos)
+            return NULL; /* Reached the start and no match. */
+
+        pos -= jump[b[pos - 1]];
+    }
+}
+
+#ifdef SIMD_SEARCH
+/*
+ * The SIMD kernels filter the candidate positions a block at a time, by
+ * comparing the first and the last characters of `small' with the block of
+ * `big' at each. Only the candidates that match both are checked in full.
+ * The positions that do not fill a whole block are left to the next kernel
+ * down. To ignore case, the blocks are lower cased in the registers first.
+ */
+
+/*
+ * A character is an upper case letter if adding 0x80 - 'A' to it gives one
+ * of the 26 smallest signed values.
+ */
+#define UPPER_SHIFT ((char) (0x80 - 'A'))
+#define UPPER_BOUND ((char) (0x80 + 26 - 0x100))
+
+static __m128i sse2_lower(__m128i x)
+{
+    __m128i t;
+
+    t = _mm_add_epi8(x, _mm_set1_epi8(UPPER_SHIFT));
+    t = _mm_cmpgt_epi8(_mm_set1_epi8(UPPER_BOUND), t);
+    return _mm_or_si128(x, _mm_and_si128(t, _mm_set1_epi8(0x20)));
+}
+
+static AVX2_TARGET __m256i avx2_lower(__m256i x)
+{
+    __m256i t;
+
+    t = _mm256_add_epi8(x, _mm256_set1_epi8(UPPER_SHIFT));
+    t = _mm256_cmpgt_epi8(_mm256_set1_epi8(UPPER_BOUND), t);
+    return _mm256_or_si256(x, _mm256_and_si256(t, _mm256_set1_epi8(0x20)));
+}
+
+static void *sse2_search(const void *big, size_t big_size,
+    const void *small, size_t small_size, int icase)
+{
+    const unsigned char *b = big;
+    const unsigned char *p = small;
+    const unsigned char *f = icase ? fold : same;
+    __m128i first, last, x, y;
+    unsigned int mask;
+    size_t i, j, n;
+
+    n = big_size - small_size + 1; /* Number of candidate positions. */
+    first = _mm_set1_epi8((char) f[p[0]]);
+    last = _mm_set1_epi8((char) f[p[small_size - 1]]);
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        x = _mm_loadu_si128((const __m128i *) (b + i));
+        y = _mm_loadu_si128((const __m128i *) (b + i + small_size - 1));
+        if (icase) {
+            x = sse2_lower(x);
+            y = sse2_lower(y);
+        }
+
+        x = _mm_and_si128(_mm_cmpeq_epi8(first, x), _mm_cmpeq_epi8(last, y));
+
+        mask = (unsigned int) _mm_movemask_epi8(x);
+        for (j = 0; mask; ++j, mask >>= 1)
+            if (mask & 1
+                && (small_size <= 2
+                    || equal(b + i + j + 1, p + 1, small_size - 2, icase)))
+                return (void *) (b + i + j);
+    }
+
+    return quick_search(b + i, big_size - i, small, small_size, icase);
+}
+
+static AVX2_TARGET void *avx2_search(const void *big, size_t big_size,
+    const void *small, size_t small_size, int icase)
+{
+    const unsigned char *b = big;
+    const unsigned char *p = small;
+    const unsigned char *f = icase ? fold : same;
+    __m256i first, last, x, y;
+    unsigned int mask;
+    size_t i, j, n;
+
+    n = big_size - small_size + 1; /* Number of candidate positions. */
+    first = _mm256_set1_epi8((char) f[p[0]]);
+    last = _mm256_set1_epi8((char) f[p[small_size - 1]]);
+
+    for (i = 0; i + 32 <= n; i += 32) {
+        x = _mm256_loadu_si256((const __m256i *) (b + i));
+        y = _mm256_loadu_si256((const __m256i *) (b + i + small_size - 1));
+        if (icase) {
+            x = avx2_lower(x);
+            y = avx2_lower(y);
+        }
+
+        x = _mm256_and_si256(
+            _mm256_cmpeq_epi8(first, x), _mm256_cmpeq_epi8(last, y));
+
+        mask = (unsigned int) _mm256_movemask_epi8(x);
+        for (j = 0; mask; ++j, mask >>= 1)
+            if (mask & 1
+                && (small_size <= 2
+                    || equal(b + i + j + 1, p + 1, small_size - 2, icase)))
+                return (void *) (b + i + j);
+    }
+
+    return sse2_search(b + i, big_size - i, small, small_size, icase);
+}
+
+static void *reverse_sse2_search(const void *big, size_t big_size,
+    const void *small, size_t small_size, int icase)
+{
+    /* The same as sse2_search, but from the end of `big' backwards. */
+    const unsigned char *b = big;
+    const unsigned char *p = small;
+    const unsigned char *f = icase ? fold : same;
+    __m128i first, last, x, y;
+    unsigned int mask;
+    size_t i, j, n;
+
+    n = big_size - small_size + 1; /* Number of candidate positions. */
+    first = _mm_set1_epi8((char) f[p[0]]);
+    last = _mm_set1_epi8((char) f[p[small_size - 1]]);
+
+    for (i = n; i >= 16; i -= 16) {
+        x = _mm_loadu_si128((const __m128i *) (b + i - 16));
+        y = _mm_loadu_si128((const __m128i *) (b + i - 16 + small_size - 1));
+        if (icase) {
+            x = sse2_lower(x);
+            y = sse2_lower(y);
+        }
+
+        x = _mm_and_si128(_mm_cmpeq_epi8(first, x), _mm_cmpeq_epi8(last, y));
+
+        mask = (unsigned int) _mm_movemask_epi8(x);
+        for (j = 16; mask && j--;)
+            if (mask & 1U << j
+                && (small_size <= 2
+                    || equal(b + i - 16 + j + 1, p + 1, small_size - 2,
+                        icase)))
+                return (void *) (b + i - 16 + j);
+    }
+
+    /* The candidates before i. */
+    return reverse_quick_search(
+        b, i + small_size - 1, small, small_size, icase);
+}
+
+static AVX2_TARGET void *reverse_avx2_search(const void *big, size_t big_size,
+    const void *small, size_t small_size, int icase)
+{
+    const unsigned char *b = big;
+    const unsigned char *p = small;
+    const unsigned char *f = icase ? fold : same;
+    __m256i first, last, x, y;
+    unsigned int mask;
+    size_t i, j, n;
+
+    n = big_size - small_size + 1; /* Number of candidate positions. */
+    first = _mm256_set1_epi8((char) f[p[0]]);
+    last = _mm256_set1_epi8((char) f[p[small_size - 1]]);
+
+    for (i = n; i >= 32; i -= 32) {
+        x = _mm256_loadu_si256((const __m256i *) (b + i - 32));
+        y = _mm256_loadu_si256(
+            (const __m256i *) (b + i - 32 + small_size - 1));
+        if (icase) {
+            x = avx2_lower(x);
+            y = avx2_lower(y);
+        }
+
+        x = _mm256_and_si256(
+            _mm256_cmpeq_epi8(first, x), _mm256_cmpeq_epi8(last, y));
+
+        mask = (unsigned int) _mm256_movemask_epi8(x);
+        for (j = 32; mask && j--;)
+            if (mask & 1U << j
+                && (small_size <= 2
+                    || equal(b + i - 32 + j + 1, p + 1, small_size - 2,
+                        icase)))
+                return (void *) (b + i - 32 + j);
+    }
+
+    return reverse_sse2_search(
+        b, i + small_size - 1, small, small_size, icase);
+}
+
+static int have_avx2(void)
+{
+    /*
+     * AVX2 needs support from both the CPU and the operating system, which
+     * must save the YMM registers.
+     */
+#ifdef _MSC_VER
+    int info[4];
+
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return 0;
+
+    __cpuid(info, 1);
+    if (!(info[2] & 1 << 27)) /* OSXSAVE. */
+        return 0;
+
+    if ((_xgetbv(0) & 6) != 6) /* XMM and YMM state. */
+        return 0;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & 1 << 5) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+/* The search kernels, which are chosen on the first search. */
+static void *(*search)(const void *, size_t, const void *, size_t, int)
+    = NULL;
+static void *(*reverse_search)(
+    const void *, size_t, const void *, size_t, int)
+    = NULL;
+
+static void choose_kernels(void)
+{
+    int i;
+
+    for (i = 0; i < UCHAR_MAX + 1; ++i) {
+        same[i] = (unsigned char) i;
+        fold[i] = (unsigned char) (i >= 'A' && i <= 'Z' ? i - 'A' + 'a' : i);
+    }
+
+#ifdef SIMD_SEARCH
+    if (have_avx2()) {
+        search = &avx2_search;
+        reverse_search = &reverse_avx2_search;
+    } else {
+        search = &sse2_search;
+        reverse_search = &reverse_sse2_search;
+    }
+#else
+    search = &quick_search;
+    reverse_search = &reverse_quick_search;
+#endif
+}
+
+void *memmem(
+    const void *big, size_t big_size, const void *small, size_t small_size)
+{
+    /* Searches for an exact match of `small' inside of `big'. */
+    if (small_size > big_size)
+        return NULL;
+
+    /* A zero-sized `small' is deemed to match `big' immediately. */
+    if (!small_size)
+        return (void *) big;
+
+    if (search == NULL)
+        choose_kernels();
+
+    return search(big, big_size, small, small_size, 0);
+}
+
+void *memrmem(
+    const void *big, size_t big_size, const void *small, size_t small_size)
+{
+    /*
+     * Searches for the last exact match of `small' inside of `big'.
+     * A zero-sized `small' is deemed to match at the end of `big'.
+     */
+    if (small_size > big_size)
+        return NULL;
+
+    if (!small_size)
+        return (void *) ((const char *) big + big_size);
+
+    if (reverse_search == NULL)
+        choose_kernels();
+
+    return reverse_search(big, big_size, small, small_size, 0);
+}
+
+void *memcasemem(
+    const void *big, size_t big_size, const void *small, size_t small_size)
+{
+    /*
+     * The same as memmem, except that ASCII letters match regardless of
+     * case.
+     */
+    if (small_size > big_size)
+        return NULL;
+
+    if (!small_size)
+        return (void *) big;
+
+    if (search == NULL)
+        choose_kernels();
+
+    return search(big, big_size, small, small_size, 1);
+}
+
+void *memrcasemem(
+    const void *big, size_t big_size, const void *small, size_t small_size)
+{
+    /*
+     * The same as memrmem, except that ASCII letters match regardless of
+     * case.
+     */
+    if (small_size > big_size)
+        return NULL;
+
+    if (!small_size)
+        return (void *) ((const char *) big + big_size);
+
+    if (reverse_search == NULL)
+        choose_kernels();
+
+    return reverse_search(big, big_size, small, small_size, 1);
+}
+
+int set_search_kernel(int kernel)
+{
+    /*
+     * Uses the given kernel for the searches, instead of the fastest one that
+     * the CPU supports, so that each kernel can be tested. Returns 1 if the
+     * kernel is not available, in which case nothing is changed.
+     */
+    if (search == NULL)
+        choose_kernels();
+
+    switch (kernel) {
+    case QUICK_KERNEL:
+        search = &quick_search;
+        reverse_search = &reverse_quick_search;
+        return 0;
+#ifdef SIMD_SEARCH
+    case SSE2_KERNEL:
+        search = &sse2_search;
+        reverse_search = &reverse_sse2_search;
+        return 0;
+    case AVX2_KERNEL:
+        if (!have_avx2())
+            return 1;
+
+        search = &avx2_search;
+        reverse_search = &reverse_avx2_search;
+        return 0;
+#endif
+    }
+
+    return 1;
+}
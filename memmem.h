@@ -28,8 +28,24 @@
 
 #include <stddef.h>
 
+/* Search kernels. Only the quick search kernel is available everywhere. */
+#define QUICK_KERNEL 1
+#define SSE2_KERNEL  2
+#define AVX2_KERNEL  3
+
 /* Function declarations */
 void *memmem(
     const void *big, size_t big_size, const void *small, size_t small_size);
 
+void *memrmem(
+    const void *big, size_t big_size, const void *small, size_t small_size);
+
+void *memcasemem(
+    const void *big, size_t big_size, const void *small, size_t small_size);
+
+void *memrcasemem(
+    const void *big, size_t big_size, const void *small, size_t small_size);
+
+int set_search_kernel(int kernel);
+
 #endif
@@ -0,0 +1,1106 @@
+/*
+ * Copyright (c) 2026 Logan Ryan McLintock. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Regular expression search.
+ *
+ * The pattern is parsed into a syntax tree, which is compiled into two
+ * Thompson NFA programs: one for the pattern and one for the pattern
+ * reversed. The programs are run as DFAs, whose states (sets of program
+ * instructions) are built lazily when the text first needs them and are
+ * then cached. There is no backtracking, so the time taken is linear in the
+ * size of the text that is searched.
+ *
+ * Syntax:
+ *     c            A literal character.
+ *     \c           c as a literal, except for \n \t \d \D \s \S \w \W.
+ *     .            Any character except a newline.
+ *     [...]        A character class, with ranges. A leading ^ negates it,
+ *                  but a negated class does not match a newline.
+ *     ^ $          The start and the end of a line.
+ *     x* x+ x?     Zero or more, one or more, and zero or one of x.
+ *     xy x|y (x)   Concatenation, alternation and grouping.
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "debug.h"
+#include "int.h"
+#include "memmem.h"
+#include "regex.h"
+
+#define SET_SIZE ((UCHAR_MAX + 1) / CHAR_BIT)
+
+#define IN_SET(set, ch) ((set)[(ch) / CHAR_BIT] >> (ch) % CHAR_BIT & 1)
+#define ADD_TO_SET(set, ch)                                                   \
+    ((set)[(ch) / CHAR_BIT] |= (unsigned char) (1 << (ch) % CHAR_BIT))
+
+/* Syntax tree node types. */
+#define T_EMPTY 1 /* The empty string. */
+#define T_SET   2 /* One character from a set. */
+#define T_BOL   3 /* Start of line. */
+#define T_EOL   4 /* End of line. */
+#define T_CAT   5 /* l followed by r. */
+#define T_ALT   6 /* l or r. */
+#define T_STAR  7 /* Zero or more of l. */
+#define T_PLUS  8 /* One or more of l. */
+#define T_QUEST 9 /* Zero or one of l. */
+
+/*
+ * Program instructions. SET, BOL and EOL continue at the next instruction.
+ * BOL and EOL are in the direction of the scan, so they swap places in the
+ * reversed program.
+ */
+#define OP_SET   1 /* Consume a character from the set. */
+#define OP_SPLIT 2 /* Continue at both x and y. */
+#define OP_JUMP  3 /* Continue at x. */
+#define OP_BOL   4 /* Continue if the last character read was a newline. */
+#define OP_EOL   5 /* Continue if the next character to read is a newline. */
+#define OP_MATCH 6
+
+/* Must be a power of two. */
+#define DFA_HASH_SIZE 1024
+
+/* The cache is emptied when it reaches this many states. */
+#define DFA_MAX_STATES 1024
+
+struct node {
+    int type;
+    size_t l; /* Left child. */
+    size_t r; /* Right child. */
+    unsigned char set[SET_SIZE];
+};
+
+struct parser {
+    const unsigned char *p;   /* Next pattern character. */
+    const unsigned char *end; /* End of the pattern (exclusive). */
+    struct node *a;           /* Syntax tree nodes. */
+    size_t n;                 /* Number of nodes used. */
+    size_t max;               /* Number of nodes allocated. */
+};
+
+struct inst {
+    int op;
+    size_t x;
+    size_t y;
+    unsigned char set[SET_SIZE];
+};
+
+struct prog {
+    struct inst *a;
+    size_t n; /* Number of instructions. */
+};
+
+/* State flags. */
+#define S_BOL       1 /* The last character read was a newline. */
+#define S_START     2 /* A start state, which is only flagged if asked for. */
+#define S_MATCH     4 /* A match ends here. */
+#define S_EOL_MATCH 8 /* A match ends here if a newline is next. */
+
+/*
+ * A DFA state is the set of instructions that the threads are waiting on:
+ * SET and MATCH, and the EOL assertions that depend on the next character.
+ * The set is sorted, so that equal sets make the same state.
+ */
+struct state {
+    size_t *set;
+    size_t n;
+    int flags;
+    /* Cached transitions. NULL means not worked out yet. */
+    struct state *next[UCHAR_MAX + 1];
+    struct state *chain; /* Next state in the same hash bucket. */
+};
+
+struct dfa {
+    struct prog *p;
+    int inject;     /* Start a new thread at every position. */
+    int flag_start; /* Flag the start states. */
+    struct state *table[DFA_HASH_SIZE];
+    size_t num_states;
+    struct state *start[2]; /* Start states without and with bol. */
+    unsigned char *on;      /* Marks for working out closures. */
+    size_t *stack;          /* Stack for working out closures. */
+    size_t *list;           /* Set being built. */
+};
+
+/* The text to search, which is split into two spans. */
+struct text {
+    const unsigned char *s1;
+    size_t n1;
+    const unsigned char *s2;
+    size_t n; /* Total size. */
+};
+
+struct regex {
+    struct prog fwd; /* Program for the pattern. */
+    struct prog rev; /* Program for the pattern reversed. */
+    /*
+     * The programs are run by DFAs that start a new thread at every
+     * position (find) and by ones that do not (extend).
+     */
+    struct dfa *fwd_find;
+    struct dfa *fwd_extend;
+    struct dfa *rev_find;
+    struct dfa *rev_extend;
+    /* Literal characters that every match starts with. */
+    unsigned char *prefix;
+    size_t prefix_size;
+};
+
+static int new_node(struct parser *ps, int type, size_t l, size_t r, size_t *x)
+{
+    struct node *nd;
+
+    if (ps->n == ps->max)
+        debug(return 1);
+
+    nd = ps->a + ps->n;
+    nd->type = type;
+    nd->l = l;
+    nd->r = r;
+    memset(nd->set, 0, SET_SIZE);
+    *x = ps->n++;
+
+    return 0;
+}
+
+static unsigned char literal_escape(unsigned char ch)
+{
+    switch (ch) {
+    case 'n':
+        return '\n';
+    case 't':
+        return '\t';
+    default:
+        return ch;
+    }
+}
+
+static int class_escape(unsigned char ch, unsigned char *set)
+{
+    /*
+     * Adds the characters of the class escape \ch to set. Returns 1 if ch
+     * is not a class escape.
+     */
+    unsigned char t[SET_SIZE];
+    unsigned int i;
+
+    memset(t, 0, SET_SIZE);
+
+    switch (ch) {
+    case 'd':
+    case 'D':
+        for (i = '0'; i <= '9'; ++i) ADD_TO_SET(t, i);
+
+        break;
+    case 's':
+    case 'S':
+        for (i = 0; i < sizeof(" \t\n\v\f\r") - 1; ++i)
+            ADD_TO_SET(t, (unsigned char) " \t\n\v\f\r"[i]);
+
+        break;
+    case 'w':
+    case 'W':
+        for (i = 0; i <= UCHAR_MAX; ++i)
+            if ((i >= 'a' && i <= 'z') || (i >= 'A' && i <= 'Z')
+                || (i >= '0' && i <= '9') || i == '_')
+                ADD_TO_SET(t, i);
+
+        break;
+    default:
+        return 1;
+    }
+
+    /* The upper case escapes are the opposite of the lower case ones. */
+    for (i = 0; i < SET_SIZE; ++i)
+        set[i] |= ch == 'D' || ch == 'S' || ch == 'W' ? ~t[i] : t[i];
+
+    return 0;
+}
+
+static int parse_class(struct parser *ps, unsigned char *set)
+{
+    /* Parses a character class. The opening [ has been read. */
+    int negate = 0, first = 1;
+    unsigned int lo, hi, i;
+
+    if (ps->p < ps->end && *ps->p == '^') {
+        negate = 1;
+        ++ps->p;
+    }
+
+    while (1) {
+        if (ps->p == ps->end)
+            return 1; /* Missing ]. */
+
+        lo = *ps->p++;
+        if (lo == ']' && !first)
+            break;
+
+        first = 0;
+
+        if (lo == '\\') {
+            if (ps->p == ps->end)
+                return 1; /* Trailing backslash. */
+
+            lo = *ps->p++;
+            if (!class_escape((unsigned char) lo, set))
+                continue;
+
+            lo = literal_escape((unsigned char) lo);
+        }
+
+        hi = lo;
+        if (ps->end - ps->p >= 2 && *ps->p == '-' && ps->p[1] != ']') {
+            ++ps->p;
+            hi = *ps->p++;
+            if (hi == '\\') {
+                if (ps->p == ps->end)
+                    return 1; /* Trailing backslash. */
+
+                hi = literal_escape(*ps->p++);
+            }
+
+            if (hi < lo)
+                return 1; /* Range is out of order. */
+        }
+
+        for (i = lo; i <= hi; ++i) ADD_TO_SET(set, i);
+    }
+
+    /* Like ., a negated class does not match a newline. */
+    if (negate) {
+        ADD_TO_SET(set, '\n');
+        for (i = 0; i < SET_SIZE; ++i) set[i] = (unsigned char) ~set[i];
+    }
+
+    return 0;
+}
+
+static int parse_alt(struct parser *ps, size_t *x);
+
+static int parse_atom(struct parser *ps, size_t *x)
+{
+    unsigned char ch = *ps->p++;
+    unsigned int i;
+
+    switch (ch) {
+    case '(':
+        if (parse_alt(ps, x))
+            return 1;
+
+        if (ps->p == ps->end || *ps->p != ')')
+            return 1; /* Missing ). */
+
+        ++ps->p;
+        return 0;
+    case '*':
+    case '+':
+    case '?':
+        return 1; /* Nothing to repeat. */
+    case '^':
+        return new_node(ps, T_BOL, 0, 0, x);
+    case '$':
+        return new_node(ps, T_EOL, 0, 0, x);
+    }
+
+    if (new_node(ps, T_SET, 0, 0, x))
+        debug(return 1);
+
+    switch (ch) {
+    case '.':
+        for (i = 0; i <= UCHAR_MAX; ++i)
+            if (i != '\n')
+                ADD_TO_SET(ps->a[*x].set, i);
+
+        break;
+    case '[':
+        if (parse_class(ps, ps->a[*x].set))
+            return 1;
+
+        break;
+    case '\\':
+        if (ps->p == ps->end)
+            return 1; /* Trailing backslash. */
+
+        ch = *ps->p++;
+        if (class_escape(ch, ps->a[*x].set)) {
+            ch = literal_escape(ch);
+            ADD_TO_SET(ps->a[*x].set, ch);
+        }
+
+        break;
+    default:
+        ADD_TO_SET(ps->a[*x].set, ch);
+        break;
+    }
+
+    return 0;
+}
+
+static int parse_repeat(struct parser *ps, size_t *x)
+{
+    int type;
+
+    if (parse_atom(ps, x))
+        return 1;
+
+    while (ps->p < ps->end) {
+        if (*ps->p == '*')
+            type = T_STAR;
+        else if (*ps->p == '+')
+            type = T_PLUS;
+        else if (*ps->p == '?')
+            type = T_QUEST;
+        else
+            break;
+
+        ++ps->p;
+        if (new_node(ps, type, *x, 0, x))
+            debug(return 1);
+    }
+
+    return 0;
+}
+
+static int parse_cat(struct parser *ps, size_t *x)
+{
+    size_t y;
+    int have = 0;
+
+    while (ps->p < ps->end && *ps->p != '|' && *ps->p != ')') {
+        if (parse_repeat(ps, have ? &y : x))
+            return 1;
+
+        if (have && new_node(ps, T_CAT, *x, y, x))
+            debug(return 1);
+
+        have = 1;
+    }
+
+    if (!have && new_node(ps, T_EMPTY, 0, 0, x))
+        debug(return 1);
+
+    return 0;
+}
+
+static int parse_alt(struct parser *ps, size_t *x)
+{
+    size_t y;
+
+    if (parse_cat(ps, x))
+        return 1;
+
+    while (ps->p < ps->end && *ps->p == '|') {
+        ++ps->p;
+        if (parse_cat(ps, &y))
+            return 1;
+
+        if (new_node(ps, T_ALT, *x, y, x))
+            debug(return 1);
+    }
+
+    return 0;
+}
+
+static size_t emit(struct prog *pr, int op)
+{
+    /* There is always room, as the program size is worked out up front. */
+    struct inst *in = pr->a + pr->n;
+
+    in->op = op;
+    in->x = 0;
+    in->y = 0;
+    memset(in->set, 0, SET_SIZE);
+
+    return pr->n++;
+}
+
+static void compile(
+    const struct node *a, size_t x, int reverse, struct prog *pr)
+{
+    /* Appends the instructions for node x. */
+    const struct node *nd = a + x;
+    size_t i, j;
+
+    switch (nd->type) {
+    case T_SET:
+        i = emit(pr, OP_SET);
+        memcpy(pr->a[i].set, nd->set, SET_SIZE);
+        break;
+    case T_BOL:
+        emit(pr, reverse ? OP_EOL : OP_BOL);
+        break;
+    case T_EOL:
+        emit(pr, reverse ? OP_BOL : OP_EOL);
+        break;
+    case T_CAT:
+        compile(a, reverse ? nd->r : nd->l, reverse, pr);
+        compile(a, reverse ? nd->l : nd->r, reverse, pr);
+        break;
+    case T_ALT:
+        i = emit(pr, OP_SPLIT);
+        pr->a[i].x = pr->n;
+        compile(a, nd->l, reverse, pr);
+        j = emit(pr, OP_JUMP);
+        pr->a[i].y = pr->n;
+        compile(a, nd->r, reverse, pr);
+        pr->a[j].x = pr->n;
+        break;
+    case T_STAR:
+        i = emit(pr, OP_SPLIT);
+        pr->a[i].x = pr->n;
+        compile(a, nd->l, reverse, pr);
+        j = emit(pr, OP_JUMP);
+        pr->a[j].x = i;
+        pr->a[i].y = pr->n;
+        break;
+    case T_PLUS:
+        i = pr->n;
+        compile(a, nd->l, reverse, pr);
+        j = emit(pr, OP_SPLIT);
+        pr->a[j].x = i;
+        pr->a[j].y = pr->n;
+        break;
+    case T_QUEST:
+        i = emit(pr, OP_SPLIT);
+        pr->a[i].x = pr->n;
+        compile(a, nd->l, reverse, pr);
+        pr->a[i].y = pr->n;
+        break;
+    }
+}
+
+static int get_prefix(Regex re, const struct node *a, size_t x)
+{
+    /*
+     * Appends the literal characters that every match of node x starts
+     * with to the prefix. Returns 1 if all of node x went into the prefix,
+     * so that what follows it can be added too.
+     */
+    const struct node *nd = a + x;
+    unsigned int i, ch = 0, count = 0;
+
+    switch (nd->type) {
+    case T_EMPTY:
+    case T_BOL:
+    case T_EOL:
+        return 1;
+    case T_SET:
+        for (i = 0; i <= UCHAR_MAX; ++i)
+            if (IN_SET(nd->set, i)) {
+                ch = i;
+                ++count;
+            }
+
+        if (count != 1)
+            return 0;
+
+        re->prefix[re->prefix_size++] = (unsigned char) ch;
+        return 1;
+    case T_CAT:
+        return get_prefix(re, a, nd->l) && get_prefix(re, a, nd->r);
+    case T_PLUS:
+        get_prefix(re, a, nd->l);
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+static void flush_states(struct dfa *d)
+{
+    struct state *s, *t;
+    size_t i;
+
+    for (i = 0; i < DFA_HASH_SIZE; ++i) {
+        s = d->table[i];
+        while (s != NULL) {
+            t = s->chain;
+            free(s->set);
+            free(s);
+            s = t;
+        }
+
+        d->table[i] = NULL;
+    }
+
+    d->num_states = 0;
+    d->start[0] = NULL;
+    d->start[1] = NULL;
+}
+
+static void free_dfa(struct dfa *d)
+{
+    if (d != NULL) {
+        flush_states(d);
+        free(d->on);
+        free(d->stack);
+        free(d->list);
+        free(d);
+    }
+}
+
+static struct dfa *init_dfa(struct prog *p, int inject, int flag_start)
+{
+    struct dfa *d = NULL;
+    size_t i;
+
+    if ((d = calloc(1, sizeof(struct dfa))) == NULL)
+        debug(goto error);
+
+    d->on = NULL;
+    d->stack = NULL;
+    d->list = NULL;
+    for (i = 0; i < DFA_HASH_SIZE; ++i) d->table[i] = NULL;
+
+    d->start[0] = NULL;
+    d->start[1] = NULL;
+    d->p = p;
+    d->inject = inject;
+    d->flag_start = flag_start;
+
+    if ((d->on = calloc(p->n, 1)) == NULL)
+        debug(goto error);
+
+    /* Each marked instruction pushes at most two more. */
+    if (mult_overflow(p->n, 2 * sizeof(size_t)))
+        debug(goto error);
+
+    if ((d->stack = malloc((2 * p->n + 1) * sizeof(size_t))) == NULL)
+        debug(goto error);
+
+    if ((d->list = malloc(p->n * sizeof(size_t))) == NULL)
+        debug(goto error);
+
+    return d;
+
+error:
+    free_dfa(d);
+    debug(return NULL);
+}
+
+static void add_inst(struct dfa *d, size_t pc, int bol, int eol)
+{
+    /*
+     * Marks pc and the instructions that can be reached from it without
+     * reading a character.
+     */
+    const struct inst *in;
+    size_t sp = 0;
+
+    d->stack[sp++] = pc;
+    while (sp) {
+        pc = d->stack[--sp];
+        if (d->on[pc])
+            continue;
+
+        d->on[pc] = 1;
+        in = d->p->a + pc;
+        switch (in->op) {
+        case OP_SPLIT:
+            d->stack[sp++] = in->y;
+            d->stack[sp++] = in->x;
+            break;
+        case OP_JUMP:
+            d->stack[sp++] = in->x;
+            break;
+        case OP_BOL:
+            if (bol)
+                d->stack[sp++] = pc + 1;
+
+            break;
+        case OP_EOL:
+            if (eol)
+                d->stack[sp++] = pc + 1;
+
+            break;
+        }
+    }
+}
+
+static size_t take_marks(struct dfa *d)
+{
+    /*
+     * Moves the marked SET, EOL and MATCH instructions into the list, in
+     * order, and clears the marks. Returns the size of the list.
+     */
+    size_t pc, n = 0;
+    int op;
+
+    for (pc = 0; pc < d->p->n; ++pc)
+        if (d->on[pc]) {
+            d->on[pc] = 0;
+            op = d->p->a[pc].op;
+            if (op == OP_SET || op == OP_EOL || op == OP_MATCH)
+                d->list[n++] = pc;
+        }
+
+    return n;
+}
+
+static int has_match(const struct prog *p, const size_t *set, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; ++i)
+        if (p->a[set[i]].op == OP_MATCH)
+            return 1;
+
+    return 0;
+}
+
+static struct state *get_state(
+    struct dfa *d, const size_t *set, size_t n, int bol)
+{
+    /* Finds the state for the set, or makes it if it is not cached. */
+    struct state *s;
+    size_t h = (size_t) bol, i;
+
+    for (i = 0; i < n; ++i) h = h * 31 + set[i];
+
+    h &= DFA_HASH_SIZE - 1;
+
+    for (s = d->table[h]; s != NULL; s = s->chain)
+        if ((s->flags & S_BOL) == bol && s->n == n
+            && !memcmp(s->set, set, n * sizeof(size_t)))
+            return s;
+
+    if ((s = malloc(sizeof(struct state))) == NULL)
+        debug(return NULL);
+
+    if ((s->set = malloc(n ? n * sizeof(size_t) : 1)) == NULL) {
+        free(s);
+        debug(return NULL);
+    }
+
+    memcpy(s->set, set, n * sizeof(size_t));
+    s->n = n;
+    s->flags = bol;
+    for (i = 0; i < UCHAR_MAX + 1; ++i) s->next[i] = NULL;
+
+    if (has_match(d->p, s->set, n))
+        s->flags |= S_MATCH;
+
+    /* The set might be d->list, so this is done after it is copied. */
+    for (i = 0; i < n; ++i) add_inst(d, s->set[i], bol, 1);
+
+    if (has_match(d->p, d->list, take_marks(d)))
+        s->flags |= S_EOL_MATCH;
+
+    s->chain = d->table[h];
+    d->table[h] = s;
+    ++d->num_states;
+
+    return s;
+}
+
+static struct state *start_state(struct dfa *d, int bol)
+{
+    if (d->start[bol] == NULL) {
+        add_inst(d, 0, bol, 0);
+        if ((d->start[bol] = get_state(d, d->list, take_marks(d), bol))
+            == NULL)
+            debug(return NULL);
+
+        if (d->flag_start)
+            d->start[bol]->flags |= S_START;
+    }
+
+    return d->start[bol];
+}
+
+static struct state *add_transition(
+    struct dfa *d, struct state *s, unsigned int ch)
+{
+    /*
+     * Works out the transition from s on ch and caches it. If the cache is
+     * full then it is emptied first, and s is remade. Returns the state
+     * that holds the transition.
+     */
+    const struct inst *in;
+    size_t i, n = s->n;
+    int bol = ch == '\n';
+
+    if (d->num_states >= DFA_MAX_STATES) {
+        memcpy(d->list, s->set, n * sizeof(size_t));
+        bol = s->flags & S_BOL;
+        flush_states(d);
+        if ((s = get_state(d, d->list, n, bol)) == NULL)
+            debug(return NULL);
+
+        /*
+         * Remake the start states too, so that they are still flagged. This
+         * uses the list, so it is done after s is remade.
+         */
+        if (start_state(d, 0) == NULL || start_state(d, 1) == NULL)
+            debug(return NULL);
+
+        bol = ch == '\n';
+    }
+
+    memcpy(d->list, s->set, n * sizeof(size_t));
+
+    /* The end of line assertions hold before a newline. */
+    if (ch == '\n') {
+        for (i = 0; i < s->n; ++i)
+            add_inst(d, s->set[i], s->flags & S_BOL, 1);
+
+        n = take_marks(d);
+    }
+
+    for (i = 0; i < n; ++i) {
+        in = d->p->a + d->list[i];
+        if (in->op == OP_SET && IN_SET(in->set, ch))
+            add_inst(d, d->list[i] + 1, bol, 0);
+    }
+
+    if (d->inject)
+        add_inst(d, 0, bol, 0);
+
+    if ((s->next[ch] = get_state(d, d->list, take_marks(d), bol)) == NULL)
+        debug(return NULL);
+
+    return s;
+}
+
+static unsigned int char_at(const struct text *t, size_t i)
+{
+    return i < t->n1 ? t->s1[i] : t->s2[i - t->n1];
+}
+
+static int at_eol(const struct text *t, size_t i)
+{
+    return i == t->n || char_at(t, i) == '\n';
+}
+
+static int at_bol(const struct text *t, size_t i)
+{
+    return !i || char_at(t, i - 1) == '\n';
+}
+
+static size_t find_prefix(Regex re, const struct text *t, size_t i)
+{
+    /*
+     * Finds the next place at or after i where the prefix occurs. Returns
+     * the size of the text if there is none.
+     */
+    const unsigned char *p;
+    size_t j, k;
+
+    if (i < t->n1) {
+        if ((p = memmem(t->s1 + i, t->n1 - i, re->prefix, re->prefix_size))
+            != NULL)
+            return p - t->s1;
+
+        /* Places where the prefix runs from the first span into the next. */
+        j = t->n1 - i >= re->prefix_size ? t->n1 - re->prefix_size + 1 : i;
+        for (; j < t->n1; ++j) {
+            for (k = 0; k < re->prefix_size && j + k < t->n
+                 && char_at(t, j + k) == re->prefix[k];
+                 ++k);
+
+            if (k == re->prefix_size)
+                return j;
+        }
+
+        i = t->n1;
+    }
+
+    if ((p = memmem(t->s2 + (i - t->n1), t->n - i, re->prefix,
+             re->prefix_size))
+        != NULL)
+        return t->n1 + (p - t->s2);
+
+    return t->n;
+}
+
+static int first_end(Regex re, const struct text *t, size_t from,
+    struct state **s_end, size_t *end)
+{
+    /*
+     * Runs forwards from `from' to the first place where a match ends, and
+     * stores the state there. Returns 1 if there is no match.
+     */
+    struct dfa *d = re->fwd_find;
+    struct state *s;
+    size_t i = from, j;
+    unsigned int ch;
+
+    if ((s = start_state(d, at_bol(t, i))) == NULL)
+        debug(return 1);
+
+    while (1) {
+        if (s->flags & ~S_BOL) {
+            /*
+             * Only the start states are flagged when there is a prefix. No
+             * match can start before the next place that the prefix occurs.
+             */
+            if (s->flags & S_START && (j = find_prefix(re, t, i)) != i) {
+                if (j == t->n)
+                    return 1;
+
+                i = j;
+                if ((s = start_state(d, at_bol(t, i))) == NULL)
+                    debug(return 1);
+            }
+
+            if (s->flags & S_MATCH
+                || (s->flags & S_EOL_MATCH && at_eol(t, i))) {
+                *s_end = s;
+                *end = i;
+                return 0;
+            }
+        }
+
+        if (i == t->n)
+            return 1;
+
+        ch = char_at(t, i++);
+        if (s->next[ch] == NULL && (s = add_transition(d, s, ch)) == NULL)
+            debug(return 1);
+
+        s = s->next[ch];
+    }
+}
+
+static int last_end(
+    Regex re, const struct text *t, struct state *s, size_t i, size_t *end)
+{
+    /*
+     * Carries on forwards from the first match end, without starting any
+     * new threads, to the furthest place that a match ends.
+     */
+    struct dfa *d = re->fwd_extend;
+    unsigned int ch;
+
+    if ((s = get_state(d, s->set, s->n, s->flags & S_BOL)) == NULL)
+        debug(return 1);
+
+    *end = i;
+    while (s->n && i < t->n) {
+        ch = char_at(t, i++);
+        if (s->next[ch] == NULL && (s = add_transition(d, s, ch)) == NULL)
+            debug(return 1);
+
+        s = s->next[ch];
+        if (s->flags & S_MATCH || (s->flags & S_EOL_MATCH && at_eol(t, i)))
+            *end = i;
+    }
+
+    return 0;
+}
+
+static int first_start(Regex re, const struct text *t, size_t from,
+    size_t first, size_t i, size_t *start)
+{
+    /*
+     * Runs the reversed program backwards from i, the furthest match end,
+     * to find the first place that a match starts. No match ends before
+     * `first', so new threads are only started down to there, and then the
+     * scan stops when all of the threads have ended.
+     */
+    struct dfa *d = re->rev_find;
+    struct state *s;
+    unsigned int ch;
+    int found = 0;
+
+    if ((s = start_state(d, at_eol(t, i))) == NULL)
+        debug(return 1);
+
+    while (1) {
+        if (s->flags & S_MATCH || (s->flags & S_EOL_MATCH && at_bol(t, i))) {
+            *start = i;
+            found = 1;
+        }
+
+        if (i == from)
+            break;
+
+        if (i == first) {
+            d = re->rev_extend;
+            if ((s = get_state(d, s->set, s->n, s->flags & S_BOL)) == NULL)
+                debug(return 1);
+        }
+
+        if (!s->n)
+            break;
+
+        ch = char_at(t, --i);
+        if (s->next[ch] == NULL && (s = add_transition(d, s, ch)) == NULL)
+            debug(return 1);
+
+        s = s->next[ch];
+    }
+
+    if (!found)
+        debug(return 1);
+
+    return 0;
+}
+
+void free_regex(Regex re)
+{
+    if (re != NULL) {
+        free(re->fwd.a);
+        free(re->rev.a);
+        free_dfa(re->fwd_find);
+        free_dfa(re->fwd_extend);
+        free_dfa(re->rev_find);
+        free_dfa(re->rev_extend);
+        free(re->prefix);
+        free(re);
+    }
+}
+
+Regex init_regex(const char *pattern, size_t pattern_size)
+{
+    Regex re = NULL;
+    struct parser ps;
+    size_t root, max_inst;
+
+    ps.a = NULL;
+
+    if ((re = calloc(1, sizeof(struct regex))) == NULL)
+        debug(goto error);
+
+    re->fwd.a = NULL;
+    re->rev.a = NULL;
+    re->fwd_find = NULL;
+    re->fwd_extend = NULL;
+    re->rev_find = NULL;
+    re->rev_extend = NULL;
+    re->prefix = NULL;
+
+    /* At most two nodes are made for each character of the pattern. */
+    if (mult_overflow(pattern_size, 2) || add_overflow(pattern_size * 2, 2))
+        debug(goto error);
+
+    ps.max = pattern_size * 2 + 2;
+
+    if (mult_overflow(ps.max, sizeof(struct node)))
+        debug(goto error);
+
+    if ((ps.a = malloc(ps.max * sizeof(struct node))) == NULL)
+        debug(goto error);
+
+    ps.p = (const unsigned char *) pattern;
+    ps.end = ps.p + pattern_size;
+    ps.n = 0;
+
+    /* A pattern syntax error is not a bug, so it is not debug printed. */
+    if (parse_alt(&ps, &root))
+        goto error;
+
+    if (ps.p != ps.end)
+        goto error; /* Unmatched ). */
+
+    /* At most two instructions are made for each node, plus the match. */
+    if (mult_overflow(ps.n, 2) || add_overflow(ps.n * 2, 1))
+        debug(goto error);
+
+    max_inst = ps.n * 2 + 1;
+
+    if (mult_overflow(max_inst, sizeof(struct inst)))
+        debug(goto error);
+
+    if ((re->fwd.a = malloc(max_inst * sizeof(struct inst))) == NULL)
+        debug(goto error);
+
+    if ((re->rev.a = malloc(max_inst * sizeof(struct inst))) == NULL)
+        debug(goto error);
+
+    compile(ps.a, root, 0, &re->fwd);
+    emit(&re->fwd, OP_MATCH);
+    compile(ps.a, root, 1, &re->rev);
+    emit(&re->rev, OP_MATCH);
+
+    if ((re->prefix = malloc(pattern_size ? pattern_size : 1)) == NULL)
+        debug(goto error);
+
+    get_prefix(re, ps.a, root);
+
+    if ((re->fwd_find = init_dfa(&re->fwd, 1, re->prefix_size != 0)) == NULL)
+        debug(goto error);
+
+    if ((re->fwd_extend = init_dfa(&re->fwd, 0, 0)) == NULL)
+        debug(goto error);
+
+    if ((re->rev_find = init_dfa(&re->rev, 1, 0)) == NULL)
+        debug(goto error);
+
+    if ((re->rev_extend = init_dfa(&re->rev, 0, 0)) == NULL)
+        debug(goto error);
+
+    free(ps.a);
+    return re;
+
+error:
+    free(ps.a);
+    free_regex(re);
+    return NULL;
+}
+
+int regex_search(Regex re, const char *s1, size_t n1, const char *s2,
+    size_t n2, size_t from, size_t *match)
+{
+    /*
+     * Searches the text made of s1 followed by s2 for the first match that
+     * starts at or after `from', and stores where it starts in *match.
+     * Returns 1 if there is no match.
+     *
+     * The first place that a match ends is found first. The matches that
+     * start before it end at or before the furthest place found by carrying
+     * on from there, so the reversed program is run back from that place.
+     */
+    struct text t;
+    struct state *s;
+    size_t first, end;
+
+    if (add_overflow(n1, n2))
+        debug(return 1);
+
+    t.s1 = (const unsigned char *) s1;
+    t.n1 = n1;
+    t.s2 = (const unsigned char *) s2;
+    t.n = n1 + n2;
+
+    if (from > t.n)
+        return 1;
+
+    if (first_end(re, &t, from, &s, &first))
+        return 1; /* No match. */
+
+    if (last_end(re, &t, s, first, &end))
+        debug(return 1);
+
+    if (first_start(re, &t, from, first, end, match))
+        debug(return 1);
+
+    return 0;
+}
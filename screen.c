@@ -35,6 +35,7 @@
 #endif
 
 #include <ctype.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -64,6 +65,32 @@
         (sc)->s_x = (x);                                                      \
     } while (0)
 
+/*
+ * Number of column ranges that the stamps of a row keep apart, such as the
+ * two panes of a vertical split.
+ */
+#define ROW_RANGES 4
+
+/* Display classes. */
+#define PRINT_CLASS 0 /* Displayed as is. */
+#define TAB_CLASS   1 /* Displayed as TAB_SIZE spaces. */
+#define NL_CLASS    2 /* Clears to the end of the line. */
+#define CTRL_CLASS  3 /* Displayed as ^ and a letter. */
+#define OTHER_CLASS 4 /* Displayed as ?. */
+
+/*
+ * Display class of each character, so that a span can be classified without
+ * calling the ctype functions for every character. Set by init_screen.
+ */
+static unsigned char display_class[UCHAR_MAX + 1];
+
+/* The latest write to columns x to x + w - 1 of a row. Unused when w is 0. */
+struct range_stamp {
+    size_t x;
+    size_t w;
+    size_t stamp;
+};
+
 /*
  * y and x coordinates start from 0.
  * y coordinates are vertical.
@@ -88,6 +115,19 @@ struct screen {
     /* Double buffering: */
     unsigned char *current_mem; /* Mirrors the displayed screen. */
     unsigned char *next_mem;    /* Used to prepare for the next display. */
+    /*
+     * Row stamps: Every write to next_mem takes a new stamp, which is left on
+     * the rows that it writes to. So a row that keeps the same stamp has not
+     * been written to since, and refresh_screen can skip it. Each row also
+     * keeps the stamps of the column ranges that were written to, so that
+     * a write to one pane of a split does not change the stamp of the other.
+     */
+    size_t stamp;         /* Stamp of the latest write. */
+    size_t *row_stamp;    /* Stamp of the latest write to each row. */
+    size_t *shown_stamp;  /* Stamp of each row at the latest refresh. */
+    size_t stamp_h;       /* Number of rows that the stamps can hold. */
+    /* ROW_RANGES column range stamps for each row. */
+    struct range_stamp *range_stamp;
 };
 
 static int hard_clear_display(Screen sc)
@@ -105,8 +145,10 @@ static int hard_clear_display(Screen sc)
 
 int clear_screen(Screen sc, int mode)
 {
-    size_t h, w, area;
+    size_t h, w, area, y, i;
     unsigned char *t;
+    size_t *s;
+    struct range_stamp *rs;
 #ifdef _WIN32
     CONSOLE_SCREEN_BUFFER_INFO console_info;
 #else
@@ -158,6 +200,37 @@ int clear_screen(Screen sc, int mode)
     if (sc->current_mem == NULL || sc->next_mem == NULL)
         debug(return 1);
 
+    if (h > sc->stamp_h) {
+        if (mult_overflow(h, sizeof(size_t)))
+            debug(return 1);
+
+        if ((s = realloc(sc->row_stamp, h * sizeof(size_t))) == NULL)
+            debug(return 1);
+
+        sc->row_stamp = s;
+
+        if ((s = realloc(sc->shown_stamp, h * sizeof(size_t))) == NULL)
+            debug(return 1);
+
+        sc->shown_stamp = s;
+
+        if (mult_overflow(h, ROW_RANGES * sizeof(struct range_stamp)))
+            debug(return 1);
+
+        if ((rs = realloc(sc->range_stamp,
+                 h * ROW_RANGES * sizeof(struct range_stamp)))
+            == NULL)
+            debug(return 1);
+
+        sc->range_stamp = rs;
+
+        /* New rows have never been shown. Stamps start from 1. */
+        for (y = sc->stamp_h; y < h; ++y)
+            sc->shown_stamp[y] = 0;
+
+        sc->stamp_h = h;
+    }
+
     /* Only update area once memmory has been allocated. */
 
     sc->h = h;
@@ -173,6 +246,17 @@ int clear_screen(Screen sc, int mode)
 
     memset(sc->next_mem, ' ', sc->area);
 
+    ++sc->stamp;
+    for (y = 0; y < sc->h; ++y) {
+        sc->row_stamp[y] = sc->stamp;
+
+        rs = sc->range_stamp + y * ROW_RANGES;
+        rs->x = 0;
+        rs->w = sc->w;
+        rs->stamp = sc->stamp;
+        for (i = 1; i < ROW_RANGES; ++i) rs[i].w = 0;
+    }
+
     sc->y = 0;
     sc->x = 0;
 
@@ -195,12 +279,33 @@ int free_screen(Screen sc)
 
         free(sc->current_mem);
         free(sc->next_mem);
+        free(sc->row_stamp);
+        free(sc->shown_stamp);
+        free(sc->range_stamp);
         free(sc);
     }
 
     return r;
 }
 
+static void set_display_classes(void)
+{
+    int i;
+
+    for (i = 0; i <= UCHAR_MAX; ++i) {
+        if (isprint(i))
+            display_class[i] = PRINT_CLASS;
+        else if (i == '\t')
+            display_class[i] = TAB_CLASS;
+        else if (i == '\n')
+            display_class[i] = NL_CLASS;
+        else if (iscntrl(i))
+            display_class[i] = CTRL_CLASS;
+        else
+            display_class[i] = OTHER_CLASS;
+    }
+}
+
 Screen init_screen(void)
 {
 #ifdef _WIN32
@@ -214,6 +319,9 @@ Screen init_screen(void)
     /* Do not assume NULL is zero. */
     sc->current_mem = NULL;
     sc->next_mem = NULL;
+    sc->row_stamp = NULL;
+    sc->shown_stamp = NULL;
+    sc->range_stamp = NULL;
 
     if ((sc->fd = fileno(stdout)) == -1)
         debug(goto error);
@@ -241,6 +349,8 @@ Screen init_screen(void)
     if (clear_screen(sc, HARD_CLEAR))
         debug(goto error);
 
+    set_display_classes();
+
     return sc;
 
 error:
@@ -248,6 +358,45 @@ error:
     return NULL;
 }
 
+static void stamp_row(Screen sc, size_t y, size_t x, size_t w)
+{
+    /*
+     * Leaves the current stamp on columns x to x + w - 1 of row y. Ranges that
+     * are inside the new one are dropped, as it is newer. When there is no
+     * room for the range, the whole row takes the stamp, which only makes
+     * more ranges look changed.
+     */
+    struct range_stamp *rs = sc->range_stamp + y * ROW_RANGES;
+    size_t i, f = ROW_RANGES;
+
+    sc->row_stamp[y] = sc->stamp;
+
+    for (i = 0; i < ROW_RANGES; ++i) {
+        if (rs[i].w && rs[i].x == x && rs[i].w == w) {
+            rs[i].stamp = sc->stamp;
+            return;
+        }
+
+        if (rs[i].w && x <= rs[i].x && rs[i].x + rs[i].w <= x + w)
+            rs[i].w = 0;
+
+        if (!rs[i].w && f == ROW_RANGES)
+            f = i;
+    }
+
+    if (f == ROW_RANGES) {
+        for (i = 1; i < ROW_RANGES; ++i) rs[i].w = 0;
+
+        f = 0;
+        x = 0;
+        w = sc->w;
+    }
+
+    rs[f].x = x;
+    rs[f].w = w;
+    rs[f].stamp = sc->stamp;
+}
+
 /*
  * As only printable chars are added to the memory,
  * bit 7 is used as a highlight indicator.
@@ -260,6 +409,8 @@ error:
                                                                               \
         sc->next_mem[sc->y * sc->w + sc->x]                                   \
             = sc->highlight ? (ch) | 1 << 7 : (ch);                           \
+        if (sc->row_stamp[sc->y] != sc->stamp)                                \
+            stamp_row(sc, sc->y, x_origin, sub_w);                            \
         if (++sc->x == x_origin + sub_w) {                                    \
             ++sc->y;                                                          \
             sc->x = x_origin;                                                 \
@@ -275,8 +426,11 @@ int soft_clear_sub_screen(
     if (y_origin + sub_h > sc->h || x_origin + sub_w > sc->w)
         debug(return 1);
 
-    for (row_i = y_origin; row_i < y_origin + sub_h; ++row_i)
+    ++sc->stamp;
+    for (row_i = y_origin; row_i < y_origin + sub_h; ++row_i) {
         memset(sc->next_mem + row_i * sc->w + x_origin, ' ', sub_w);
+        stamp_row(sc, row_i, x_origin, sub_w);
+    }
 
     return 0;
 }
@@ -302,26 +456,93 @@ int sub_screen_print_ch(Screen sc, size_t y_origin, size_t x_origin,
     if (sc->y >= y_origin + sub_h || sc->x >= x_origin + sub_w)
         return 1;
 
-    if (isprint(ch)) {
+    ++sc->stamp;
+
+    switch (display_class[(unsigned char) ch]) {
+    case PRINT_CLASS:
         add_ch(ch);
-    } else if (ch == '\t') {
+        break;
+    case TAB_CLASS:
         j = TAB_SIZE;
         while (j--) add_ch(' ');
-    } else if (ch == '\n') {
+        break;
+    case NL_CLASS:
         /* Clear to the end of the line. */
         y_old = sc->y;
         while (sc->y == y_old) add_ch(' ');
-    } else if (iscntrl(ch)) {
+        break;
+    case CTRL_CLASS:
         add_ch('^');
         /* Toggle bit 6 (the lowest bit is bit 0). */
         add_ch(ch ^ 1 << 6);
-    } else {
+        break;
+    default:
         add_ch('?');
     }
 
     return 0;
 }
 
+int sub_screen_print_mem(Screen sc, size_t y_origin, size_t x_origin,
+    size_t sub_h, size_t sub_w, const char *mem, size_t n)
+{
+    /*
+     * Prints n characters the same way as sub_screen_print_ch, except that
+     * runs of printable characters are copied straight into the screen
+     * memory, a row at a time. Stops and returns 1 at the first character
+     * that is out of bounds, as then the sub-screen is full.
+     */
+    const unsigned char *p = (const unsigned char *) mem;
+    unsigned char *t;
+    size_t i, j, room, run;
+
+    /* Validate sub screen. */
+    if (y_origin + sub_h > sc->h || x_origin + sub_w > sc->w)
+        debug(return 1);
+
+    ++sc->stamp;
+
+    i = 0;
+    while (i < n) {
+        if (display_class[p[i]] != PRINT_CLASS) {
+            if (sub_screen_print_ch(
+                    sc, y_origin, x_origin, sub_h, sub_w, (char) p[i]))
+                return 1;
+
+            ++i;
+            continue;
+        }
+
+        if (sc->y >= y_origin + sub_h || sc->x >= x_origin + sub_w)
+            return 1;
+
+        /* The run stops at the end of the row. */
+        room = x_origin + sub_w - sc->x;
+        for (run = 1; run < room && i + run < n
+             && display_class[p[i + run]] == PRINT_CLASS;
+             ++run)
+            ;
+
+        t = sc->next_mem + sc->y * sc->w + sc->x;
+        if (sc->highlight)
+            for (j = 0; j < run; ++j)
+                t[j] = p[i + j] | 1 << 7;
+        else
+            memcpy(t, p + i, run);
+
+        if (sc->row_stamp[sc->y] != sc->stamp)
+            stamp_row(sc, sc->y, x_origin, sub_w);
+
+        i += run;
+        if ((sc->x += run) == x_origin + sub_w) {
+            ++sc->y;
+            sc->x = x_origin;
+        }
+    }
+
+    return 0;
+}
+
 #undef add_ch
 
 int sub_screen_print_str(Screen sc, size_t y_origin, size_t x_origin,
@@ -357,7 +578,13 @@ int refresh_screen(Screen sc)
     unsigned char u;
 
     es_hide_cursor();
-    for (y = 0; y < sc->h; ++y)
+    for (y = 0; y < sc->h; ++y) {
+        /* Rows that have not been written to since are already displayed. */
+        if (sc->row_stamp[y] == sc->shown_stamp[y])
+            continue;
+
+        sc->shown_stamp[y] = sc->row_stamp[y];
+
         for (x = 0; x < sc->w; ++x) {
             i = y * sc->w + x;
 
@@ -401,6 +628,7 @@ int refresh_screen(Screen sc)
                 }
             }
         }
+    }
 
     /* Set the final displayed cursor location. */
     if (sc->y != sc->s_y || sc->x != sc->s_x)
@@ -447,6 +675,28 @@ size_t get_x(Screen sc)
     return sc->x;
 }
 
+size_t get_row_stamp(Screen sc, size_t y, size_t x, size_t w)
+{
+    /*
+     * The stamp of the latest write to columns x to x + w - 1 of row y. If it
+     * is unchanged, then those columns have not been written to since. Writes
+     * to other columns of the row, such as by another pane, do not count.
+     */
+    struct range_stamp *rs;
+    size_t i, stamp = 0;
+
+    if (y >= sc->h)
+        return 0;
+
+    rs = sc->range_stamp + y * ROW_RANGES;
+    for (i = 0; i < ROW_RANGES; ++i)
+        if (rs[i].w && rs[i].x < x + w && x < rs[i].x + rs[i].w
+            && rs[i].stamp > stamp)
+            stamp = rs[i].stamp;
+
+    return stamp;
+}
+
 void highlight_on(Screen sc)
 {
     sc->highlight = 1;
@@ -52,6 +52,9 @@ int soft_clear_sub_screen(
 int sub_screen_print_ch(Screen sc, size_t y_origin, size_t x_origin,
     size_t sub_h, size_t sub_w, char ch);
 
+int sub_screen_print_mem(Screen sc, size_t y_origin, size_t x_origin,
+    size_t sub_h, size_t sub_w, const char *mem, size_t n);
+
 int sub_screen_print_str(Screen sc, size_t y_origin, size_t x_origin,
     size_t sub_h, size_t sub_w, const char *str);
 
@@ -71,6 +74,8 @@ size_t get_y(Screen sc);
 
 size_t get_x(Screen sc);
 
+size_t get_row_stamp(Screen sc, size_t y, size_t x, size_t w);
+
 void highlight_on(Screen sc);
 
 void highlight_off(Screen sc);
@@ -33,10 +33,19 @@
 #include "doubly_linked_list.c"
 #include "gap_buf.h"
 #include "input.h"
+#include "int.h"
+#include "regex.h"
 #include "screen.h"
 
 #define INIT_NUM_GB_ELEMENTS 512
 
+/*
+ * Undo memory limits in bytes, for each buffer and for all of the buffers
+ * together. The oldest history is dropped first. Zero means no limit.
+ */
+#define UNDO_LIMIT       (256UL * 1024 * 1024)
+#define TOTAL_UNDO_LIMIT (1024UL * 1024 * 1024)
+
 /* The direction when changing buffers. */
 #define LEFT_GB  0
 #define RIGHT_GB 1
@@ -56,11 +65,14 @@
 #define HORIZONTAL_SPLIT 4
 
 /* Operation. 0 means no operation. */
-#define ED_RENAME         1
-#define ED_OPEN_FILE      2
-#define ED_INSERT_FILE    3
-#define ED_FORWARD_SEARCH 4
-#define ED_INSERT_HEX     5
+#define ED_RENAME          1
+#define ED_OPEN_FILE       2
+#define ED_INSERT_FILE     3
+#define ED_FORWARD_SEARCH  4
+#define ED_INSERT_HEX      5
+#define ED_GOTO_LINE       6
+#define ED_BACKWARD_SEARCH 7
+#define ED_REGEX_SEARCH    8
 
 /* Current gap buffer, excluding the cl. */
 #define c_gb (ed->view_2 ? ed->n_2->data : ed->n->data)
@@ -85,6 +97,8 @@ struct editor {
     Gap_buf cl;     /* Command line gap buffer. */
     int cl_a;       /* Command line is active. */
     Gap_buf search; /* Search gap buffer. */
+    int icase;      /* Searches ignore case. */
+    Regex regex;    /* Last regular expression searched for. */
     Gap_buf paste;  /* Paste gap buffer. */
     int operation;  /* The operation that is using the cl. */
     Input ip;
@@ -114,6 +128,7 @@ static int free_editor(Editor ed)
         gb_free(ed->cl);
         gb_free(ed->search);
         gb_free(ed->paste);
+        free_regex(ed->regex);
 
         if (free_input(ed->ip))
             debug(r = 1);
@@ -139,6 +154,7 @@ static Editor init_editor(const struct key_map *km)
     ed->full_clear = SOFT_CLEAR;
     ed->cl = NULL;
     ed->search = NULL;
+    ed->regex = NULL;
     ed->paste = NULL;
     ed->ip = NULL;
     ed->sc = NULL;
@@ -152,6 +168,10 @@ static Editor init_editor(const struct key_map *km)
     if ((ed->paste = gb_init(INIT_NUM_GB_ELEMENTS)) == NULL)
         debug(goto error);
 
+    gb_set_undo_limit(ed->cl, UNDO_LIMIT);
+    gb_set_undo_limit(ed->search, UNDO_LIMIT);
+    gb_set_undo_limit(ed->paste, UNDO_LIMIT);
+
     if (init_input_stdin(&ed->ip, BLOCKING, DOUBLE_COOKED, km))
         debug(goto error);
 
@@ -174,6 +194,8 @@ static int add_gap_buf(Editor ed, const char *fn)
     if ((gb = gb_init(INIT_NUM_GB_ELEMENTS)) == NULL)
         debug(goto error);
 
+    gb_set_undo_limit(gb, UNDO_LIMIT);
+
     if (fn != NULL) {
         if (gb_insert_file(gb, fn) == -1)
             debug(goto error);
@@ -194,6 +216,55 @@ error:
     debug(return 1);
 }
 
+static void limit_total_undo(Editor ed)
+{
+    /*
+     * Drops the oldest history of the buffer with the most history, until
+     * the buffers in the list are within TOTAL_UNDO_LIMIT together. A buffer
+     * that cannot drop anything is passed over, and the next largest is used.
+     * Buffers are ranked by size, then by list position. A buffer that fails
+     * does not change, so the ones that rank at or above the last failure
+     * are skipped.
+     */
+    Dlln first, t, largest;
+    size_t total, s, largest_s, i, largest_i = 0, stuck_s = 0, stuck_i = 0;
+    int stuck = 0;
+
+    if (!TOTAL_UNDO_LIMIT || ed->n == NULL)
+        return;
+
+    first = ed->n;
+    while (first->prev != NULL)
+        first = first->prev;
+
+    while (1) {
+        total = 0;
+        largest = NULL;
+        largest_s = 0;
+        for (t = first, i = 0; t != NULL; t = t->next, ++i) {
+            s = gb_undo_size(t->data);
+            total += s;
+            if (stuck && (s > stuck_s || (s == stuck_s && i <= stuck_i)))
+                continue;
+
+            if (s > largest_s) {
+                largest = t;
+                largest_s = s;
+                largest_i = i;
+            }
+        }
+
+        if (total <= TOTAL_UNDO_LIMIT || largest == NULL)
+            return;
+
+        if (gb_drop_oldest_undo(largest->data)) {
+            stuck = 1;
+            stuck_s = largest_s;
+            stuck_i = largest_i;
+        }
+    }
+}
+
 static int draw_screen(Editor ed)
 {
     size_t h, w, y = 0, x = 0, y_2 = 0, x_2 = 0, cl_y = 0, cl_x = 0;
@@ -220,76 +291,45 @@ static int draw_screen(Editor ed)
 
     switch (ed->split) {
     case NO_SPLIT:
-        if (ed->full_clear || !ed->cl_a) {
-            if (!ed->full_clear)
-                if (soft_clear_sub_screen(ed->sc, 0, 0, h - 1, w))
-                    debug(return 1);
-
+        if (ed->full_clear || !ed->cl_a)
             if (gb_print(ed->n->data, ed->sc, 0, 0, h - 1, w,
                     INCLUDE_STATUS_BAR, &y, &x))
                 debug(return 1);
-        }
 
         break;
     case VERTICAL_SPLIT:
-        if (ed->full_clear || (!ed->cl_a && !ed->view_2)) {
-            if (!ed->full_clear)
-                if (soft_clear_sub_screen(ed->sc, 0, 0, h - 1, w / 2))
-                    debug(return 1);
-
+        if (ed->full_clear || (!ed->cl_a && !ed->view_2))
             if (gb_print(ed->n->data, ed->sc, 0, 0, h - 1, w / 2,
                     INCLUDE_STATUS_BAR, &y, &x))
                 debug(return 1);
-        }
-
-        if (ed->full_clear || (!ed->cl_a && ed->view_2)) {
-            if (!ed->full_clear)
-                if (soft_clear_sub_screen(ed->sc, 0, w / 2, h - 1, w / 2))
-                    debug(return 1);
 
+        if (ed->full_clear || (!ed->cl_a && ed->view_2))
             if (gb_print(ed->n_2->data, ed->sc, 0, w / 2, h - 1, w / 2,
                     INCLUDE_STATUS_BAR, &y_2, &x_2))
                 debug(return 1);
-        }
 
         break;
     case HORIZONTAL_SPLIT:
-        if (ed->full_clear || (!ed->cl_a && !ed->view_2)) {
-            if (!ed->full_clear)
-                if (soft_clear_sub_screen(ed->sc, 0, 0, h / 2, w))
-                    debug(return 1);
-
+        if (ed->full_clear || (!ed->cl_a && !ed->view_2))
             if (gb_print(ed->n->data, ed->sc, 0, 0, h / 2, w,
                     INCLUDE_STATUS_BAR, &y, &x))
                 debug(return 1);
-        }
-
-        if (ed->full_clear || (!ed->cl_a && ed->view_2)) {
-            if (!ed->full_clear)
-                if (soft_clear_sub_screen(
-                        ed->sc, h / 2, 0, h % 2 ? h / 2 : h / 2 - 1, w))
-                    debug(return 1);
 
+        if (ed->full_clear || (!ed->cl_a && ed->view_2))
             if (gb_print(ed->n_2->data, ed->sc, h / 2, 0,
                     h % 2 ? h / 2 : h / 2 - 1, w, INCLUDE_STATUS_BAR, &y_2,
                     &x_2))
                 debug(return 1);
-        }
 
         break;
     default:
         debug(return 1); /* Invalid split type. */
     }
 
-    if (ed->full_clear || ed->cl_a) {
-        if (!ed->full_clear)
-            if (soft_clear_sub_screen(ed->sc, h - 1, 1, 1, w - 1))
-                debug(return 1);
-
+    if (ed->full_clear || ed->cl_a)
         if (gb_print(ed->cl, ed->sc, h - 1, 1, 1, w - 1, EXCLUDE_STATUS_BAR,
                 &cl_y, &cl_x))
             debug(return 1);
-    }
 
     /* Display global last return value (shared across all buffers). */
     if (move(ed->sc, h - 1, 0))
@@ -344,6 +384,11 @@ static void ed_redo(Editor ed)
     ed->rv = gb_redo(a_gb);
 }
 
+static void ed_switch_branch(Editor ed)
+{
+    ed->rv = gb_switch_branch(a_gb);
+}
+
 static void ed_start_of_line(Editor ed)
 {
     gb_start_of_line(a_gb);
@@ -374,6 +419,26 @@ static void ed_down_line(Editor ed)
     ed->rv = gb_down_line(a_gb);
 }
 
+static void ed_page_down(Editor ed)
+{
+    ed->rv = gb_page_down(a_gb);
+}
+
+static void ed_page_up(Editor ed)
+{
+    ed->rv = gb_page_up(a_gb);
+}
+
+static void ed_scroll_down(Editor ed)
+{
+    ed->rv = gb_scroll_down(a_gb);
+}
+
+static void ed_scroll_up(Editor ed)
+{
+    ed->rv = gb_scroll_up(a_gb);
+}
+
 static void ed_match_brace(Editor ed)
 {
     ed->rv = gb_match_brace(a_gb);
@@ -430,9 +495,35 @@ static void ed_save(Editor ed)
     ed->rv = gb_write_file(a_gb);
 }
 
+static void ed_revert(Editor ed)
+{
+    ed->rv = gb_revert(c_gb);
+}
+
 static void ed_repeat_last_search(Editor ed)
 {
-    ed->rv = gb_forward_search(c_gb, ed->search);
+    ed->rv = gb_forward_search(c_gb, ed->search, ed->icase);
+}
+
+static void ed_repeat_last_search_backward(Editor ed)
+{
+    ed->rv = gb_backward_search(c_gb, ed->search, ed->icase);
+}
+
+static void ed_repeat_last_regex_search(Editor ed)
+{
+    if (ed->regex == NULL) {
+        ed->rv = 1;
+        return;
+    }
+
+    ed->rv = gb_regex_search(c_gb, ed->regex);
+}
+
+static void ed_toggle_case_search(Editor ed)
+{
+    ed->icase = !ed->icase;
+    ed->rv = 0;
 }
 
 /* ######################################################################## */
@@ -472,19 +563,60 @@ static void ed_forward_search(Editor ed)
     ed->rv = prepare_cl(ed, ED_FORWARD_SEARCH);
 }
 
+static void ed_backward_search(Editor ed)
+{
+    ed->rv = prepare_cl(ed, ED_BACKWARD_SEARCH);
+}
+
+static void ed_regex_search(Editor ed)
+{
+    ed->rv = prepare_cl(ed, ED_REGEX_SEARCH);
+}
+
 static void ed_insert_hex(Editor ed)
 {
     ed->rv = prepare_cl(ed, ED_INSERT_HEX);
 }
 
+static void ed_goto_line(Editor ed)
+{
+    ed->rv = prepare_cl(ed, ED_GOTO_LINE);
+}
+
+static int str_to_size_t(const char *str, size_t *num)
+{
+    /* Only accepts a string of decimal digits. */
+    size_t x = 0;
+    unsigned char u;
+
+    if (!*str)
+        return 1;
+
+    while ((u = *str++)) {
+        if (!isdigit(u))
+            return 1;
+
+        if (mult_overflow(x, 10) || add_overflow(x * 10, u - '0'))
+            return 1;
+
+        x = x * 10 + (u - '0');
+    }
+
+    *num = x;
+    return 0;
+}
+
 static void process_cl_operation(Editor ed)
 {
     const char *cl_str = NULL;
+    size_t cl_n, row;
+    Regex re;
 
     ed->rv = 1; /* Default is failure. */
 
-    if (ed->operation != ED_FORWARD_SEARCH)
-        if ((cl_str = gb_to_str(ed->cl)) == NULL)
+    if (ed->operation != ED_FORWARD_SEARCH
+        && ed->operation != ED_BACKWARD_SEARCH)
+        if ((cl_str = gb_make_contiguous(ed->cl, &cl_n)) == NULL)
             debug(goto end);
 
     switch (ed->operation) {
@@ -502,11 +634,32 @@ static void process_cl_operation(Editor ed)
         if (gb_insert_gb(ed->search, ed->cl))
             debug(break);
 
-        ed->rv = gb_forward_search(c_gb, ed->search);
+        ed->rv = gb_forward_search(c_gb, ed->search, ed->icase);
+        break;
+    case ED_BACKWARD_SEARCH:
+        gb_reset(ed->search);
+        if (gb_insert_gb(ed->search, ed->cl))
+            debug(break);
+
+        ed->rv = gb_backward_search(c_gb, ed->search, ed->icase);
+        break;
+    case ED_REGEX_SEARCH:
+        if ((re = init_regex(cl_str, cl_n)) == NULL)
+            break; /* Invalid pattern. */
+
+        free_regex(ed->regex);
+        ed->regex = re;
+        ed->rv = gb_regex_search(c_gb, ed->regex);
         break;
     case ED_INSERT_HEX:
         ed->rv = gb_insert_hex_str(c_gb, cl_str);
         break;
+    case ED_GOTO_LINE:
+        if (str_to_size_t(cl_str, &row))
+            break;
+
+        ed->rv = gb_goto_line(c_gb, row);
+        break;
     default:
         debug(break); /* Invalid operation. */
     }
@@ -587,6 +740,9 @@ static void change_gb(Editor ed, int direction)
 
     while ((t = direction == LEFT_GB ? t->prev : t->next) != NULL)
         if (t != skip) {
+            /* Give back memory from the buffer that is being left. */
+            gb_compact(c_gb);
+
             if (ed->view_2)
                 ed->n_2 = t;
             else
@@ -661,6 +817,8 @@ int main(int argc, char **argv)
             && (isprint(ed->ch) || ed->ch == '\t' || ed->ch == '\n')
             && gb_insert_ch(a_gb, (char) ed->ch))
             debug(goto error);
+
+        limit_total_undo(ed);
     }
 
     return free_editor(ed);
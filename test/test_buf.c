@@ -24,6 +24,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include <buf.h>
 #include <debug.h>
@@ -34,18 +35,21 @@
 int main(void)
 {
     Buf b = NULL;
-    char str[ELEMENT_SIZE];
+    char str[ELEMENT_SIZE], in[ELEMENT_SIZE];
 
     if ((b = init_buf(INIT_NUM_ELEMENTS, ELEMENT_SIZE)) == NULL)
         debug(goto error);
 
-    if (push(b, "cool"))
+    strcpy(in, "cool");
+    if (push(b, in))
         debug(goto error);
 
-    if (push(b, "elephant!"))
+    strcpy(in, "elephant!");
+    if (push(b, in))
         debug(goto error);
 
-    if (push(b, "whale"))
+    strcpy(in, "whale");
+    if (push(b, in))
         debug(goto error);
 
     if (pop(b, str))
@@ -63,6 +67,24 @@ int main(void)
 
     printf("%s\n", str);
 
+    strcpy(in, "dolphin");
+    if (push(b, in))
+        debug(goto error);
+
+    strcpy(in, "octopus");
+    if (push(b, in))
+        debug(goto error);
+
+    if (pop_bottom_n(b, str, 1))
+        debug(goto error);
+
+    printf("%s\n", str);
+
+    if (pop(b, str))
+        debug(goto error);
+
+    printf("%s\n", str);
+
     free_buf(b);
     return 0;
 
@@ -24,15 +24,25 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include <debug.h>
 #include <gap_buf.h>
 
 #define INIT_NUM_ELEMENTS 10
+#define REVERT_FN         "test_revert.txt"
+#define TRIM_IN           "one  \t\nt\rwo\r\r\r\nthree\t \n\n\n\n"
+#define TRIM_OUT          "one\ntwo\nthree\n"
+#define PAGE_H            6
+#define PAGE_W            20
+#define SHORT_LINE        "short line\n"
+#define LONG_LINE         "this long line wraps over three rows of text\n"
 
 int main(void)
 {
-    Gap_buf gb;
+    Gap_buf gb, search = NULL, rv = NULL;
+    const char *p, *q, *before, *after;
+    size_t before_n, after_n, n, m, i, top, top_2, g;
 
     if ((gb = gb_init(INIT_NUM_ELEMENTS)) == NULL)
         debug(goto error);
@@ -128,10 +138,255 @@ int main(void)
 
     gb_debug_print(gb);
 
+    printf("Insert a span:\n");
+
+    if (gb_insert_mem(gb, "hello\nworld", 11))
+        debug(goto error);
+
+    gb_debug_print(gb);
+
+    printf("Undo:\n");
+
+    if (gb_undo(gb))
+        debug(goto error);
+
+    gb_debug_print(gb);
+
+    printf("Go to line 3:\n");
+
+    if (gb_goto_line(gb, 3))
+        debug(goto error);
+
+    gb_debug_print(gb);
+
+    printf("Type two words:\n");
+
+    for (p = "two words"; *p != '\0'; ++p)
+        if (gb_insert_ch(gb, *p))
+            debug(goto error);
+
+    gb_debug_print(gb);
+
+    printf("Undo the last word:\n");
+
+    if (gb_undo(gb))
+        debug(goto error);
+
+    gb_debug_print(gb);
+
+    printf("Type a different word:\n");
+
+    for (p = "things"; *p != '\0'; ++p)
+        if (gb_insert_ch(gb, *p))
+            debug(goto error);
+
+    gb_debug_print(gb);
+
+    printf("Switch branch and redo:\n");
+
+    if (gb_switch_branch(gb))
+        debug(goto error);
+
+    if (gb_redo(gb))
+        debug(goto error);
+
+    gb_debug_print(gb);
+
+    printf("Spans before and after the gap:\n");
+
+    gb_spans(gb, &before, &before_n, &after, &after_n);
+    fwrite(before, 1, before_n, stdout);
+    printf("|");
+    fwrite(after, 1, after_n, stdout);
+    printf("\n");
+
+    printf("Make contiguous:\n");
+
+    if ((p = gb_make_contiguous(gb, NULL)) == NULL)
+        debug(goto error);
+
+    printf("%s\n", p);
+
+    gb_debug_print(gb);
+
+    printf("Match brace:\n");
+
+    gb_end_of_buffer(gb);
+
+    if (gb_insert_mem(gb, "(a(b)c)", 7))
+        debug(goto error);
+
+    if (gb_left_ch(gb))
+        debug(goto error);
+
+    if (gb_match_brace(gb))
+        debug(goto error);
+
+    gb_debug_print(gb);
+
+    printf("Backward search:\n");
+
+    if ((search = gb_init(INIT_NUM_ELEMENTS)) == NULL)
+        debug(goto error);
+
+    if (gb_insert_mem(search, "words", 5))
+        debug(goto error);
+
+    if (gb_backward_search(gb, search, 0))
+        debug(goto error);
+
+    gb_debug_print(gb);
+
+    printf("Backward search ignoring case:\n");
+
+    gb_reset(search);
+
+    if (gb_insert_mem(search, "TWO", 3))
+        debug(goto error);
+
+    if (gb_backward_search(gb, search, 1))
+        debug(goto error);
+
+    gb_debug_print(gb);
+
+    printf("Save, edit, undo to the save and revert:\n");
+
+    if ((rv = gb_init(INIT_NUM_ELEMENTS)) == NULL)
+        debug(goto error);
+
+    if (gb_set_fn(rv, REVERT_FN))
+        debug(goto error);
+
+    if (gb_insert_mem(rv, "saved\ntext", 10))
+        debug(goto error);
+
+    if (gb_write_file(rv))
+        debug(goto error);
+
+    printf("Modified after save: %d\n", gb_is_modified(rv));
+
+    if (gb_insert_mem(rv, " edited", 7))
+        debug(goto error);
+
+    printf("Modified after edit: %d\n", gb_is_modified(rv));
+
+    if (gb_undo(rv))
+        debug(goto error);
+
+    printf("Modified after undo: %d\n", gb_is_modified(rv));
+
+    gb_start_of_buffer(rv);
+
+    if (gb_insert_mem(rv, "new ", 4))
+        debug(goto error);
+
+    gb_debug_print(rv);
+
+    if (gb_revert(rv))
+        debug(goto error);
+
+    printf("Modified after revert: %d\n", gb_is_modified(rv));
+
+    gb_debug_print(rv);
+
+    gb_reset(search);
+
+    if (gb_insert_file(search, REVERT_FN))
+        debug(goto error);
+
+    if ((p = gb_make_contiguous(rv, &n)) == NULL
+        || (q = gb_make_contiguous(search, &m)) == NULL)
+        debug(goto error);
+
+    printf("Matches the file: %s\n",
+        n == m && !memcmp(p, q, n) ? "yes" : "no");
+
+    if (gb_insert_mem(rv, " more", 5))
+        debug(goto error);
+
+    /* The save was to the old name, so there is nothing to revert to. */
+    if (gb_set_fn(rv, REVERT_FN))
+        debug(goto error);
+
+    printf("Revert after renaming fails: %s\n", gb_revert(rv) ? "yes" : "no");
+    printf("Modified after failed revert: %d\n", gb_is_modified(rv));
+
+    printf("Trim and clean, then undo once:\n");
+
+    gb_reset(search);
+
+    if (gb_insert_mem(search, TRIM_IN, strlen(TRIM_IN)))
+        debug(goto error);
+
+    if (gb_move_to(search, 9))
+        debug(goto error);
+
+    if (gb_trim_clean(search))
+        debug(goto error);
+
+    gb_debug_print(search);
+
+    if ((p = gb_make_contiguous(search, &n)) == NULL)
+        debug(goto error);
+
+    printf("Trimmed: %s\n",
+        n == strlen(TRIM_OUT) && !memcmp(p, TRIM_OUT, n) ? "yes" : "no");
+
+    if (gb_undo(search))
+        debug(goto error);
+
+    if ((p = gb_make_contiguous(search, &n)) == NULL)
+        debug(goto error);
+
+    printf("Restored: %s\n",
+        n == strlen(TRIM_IN) && !memcmp(p, TRIM_IN, n) ? "yes" : "no");
+
+    printf("Page down twice and up twice, with long lines that wrap:\n");
+
+    gb_reset(search);
+
+    for (i = 0; i < 30; ++i) {
+        p = i % 4 ? SHORT_LINE : LONG_LINE;
+        if (gb_insert_mem(search, p, strlen(p)))
+            debug(goto error);
+    }
+
+    /* Paging moves the cursor to the start of its row on the screen. */
+    gb_start_of_buffer(search);
+
+    if (gb_down_line(search))
+        debug(goto error);
+
+    if (gb_lay_out(search, PAGE_H, PAGE_W, &top))
+        debug(goto error);
+
+    gb_spans(search, &before, &g, &after, &after_n);
+
+    for (i = 0; i < 4; ++i) {
+        if (i < 2 ? gb_page_down(search) : gb_page_up(search))
+            debug(goto error);
+
+        if (gb_lay_out(search, PAGE_H, PAGE_W, &top_2))
+            debug(goto error);
+
+        gb_spans(search, &before, &before_n, &after, &after_n);
+        printf("Top: %lu, cursor: %lu\n", (unsigned long) top_2,
+            (unsigned long) before_n);
+    }
+
+    printf("Same top row and cursor: %s\n",
+        top_2 == top && before_n == g ? "yes" : "no");
+
+    remove(REVERT_FN);
+    gb_free(rv);
+    gb_free(search);
     gb_free(gb);
     return 0;
 
 error:
+    remove(REVERT_FN);
+    gb_free(rv);
+    gb_free(search);
     gb_free(gb);
     debug(return 1);
 }
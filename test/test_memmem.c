@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2026 Logan Ryan McLintock. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <debug.h>
+#include <memmem.h>
+
+#define MAX_BIG     160
+#define NUM_RANDOM  20
+#define NUM_SIZES   5
+#define NUM_SEARCH  4
+#define FORWARD     0
+#define REVERSE     1
+
+static const size_t sizes[NUM_SIZES] = { 1, 2, 16, 32, 33 };
+
+static unsigned char fold(unsigned char ch)
+{
+    return (unsigned char) (ch >= 'A' && ch <= 'Z' ? ch - 'A' + 'a' : ch);
+}
+
+static const char *naive(const char *big, size_t big_size, const char *small,
+    size_t small_size, int icase, int reverse)
+{
+    /* The match that each search should find, checking every position. */
+    const char *found = NULL;
+    size_t i, j;
+
+    if (small_size > big_size)
+        return NULL;
+
+    for (i = 0; i <= big_size - small_size; ++i) {
+        for (j = 0; j < small_size; ++j)
+            if (icase ? fold(big[i + j]) != fold(small[j])
+                      : big[i + j] != small[j])
+                break;
+
+        if (j == small_size) {
+            found = big + i;
+            if (!reverse)
+                break;
+        }
+    }
+
+    return found;
+}
+
+static int check(const char *big, size_t big_size, const char *small,
+    size_t small_size)
+{
+    /* Runs the four searches, and compares them with the naive search. */
+    const char *r;
+    int k;
+
+    for (k = 0; k < NUM_SEARCH; ++k) {
+        switch (k) {
+        case 0:
+            r = memmem(big, big_size, small, small_size);
+            break;
+        case 1:
+            r = memrmem(big, big_size, small, small_size);
+            break;
+        case 2:
+            r = memcasemem(big, big_size, small, small_size);
+            break;
+        default:
+            r = memrcasemem(big, big_size, small, small_size);
+        }
+
+        if (r != naive(big, big_size, small, small_size, k >= 2, k % 2)) {
+            printf("Search %d differs: big size %lu, small size %lu\n", k,
+                (unsigned long) big_size, (unsigned long) small_size);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int test_kernel(void)
+{
+    char big[MAX_BIG], small[MAX_BIG];
+    size_t s, n, i, k;
+
+    for (s = 0; s < NUM_SIZES; ++s) {
+        for (n = sizes[s]; n < MAX_BIG; ++n) {
+            /* Matches at both ends, with the case swapped at the end. */
+            memset(big, 'x', n);
+            for (i = 0; i < sizes[s]; ++i) {
+                small[i] = (char) ('a' + i % 26);
+                big[i] = small[i];
+                big[n - sizes[s] + i] = (char) ('A' + i % 26);
+            }
+
+            if (check(big, n, small, sizes[s]))
+                debug(return 1);
+
+            /* Random text, with few letters, so that there are matches. */
+            for (k = 0; k < NUM_RANDOM; ++k) {
+                for (i = 0; i < n; ++i) big[i] = "abAB"[rand() % 4];
+
+                if (rand() % 2)
+                    memcpy(small, big + rand() % (n - sizes[s] + 1), sizes[s]);
+                else
+                    for (i = 0; i < sizes[s]; ++i)
+                        small[i] = "abAB"[rand() % 4];
+
+                if (check(big, n, small, sizes[s]))
+                    debug(return 1);
+            }
+        }
+    }
+
+    return 0;
+}
+
+int main(void)
+{
+    const char *names[] = { "Quick search", "SSE2", "AVX2" };
+    const int kernels[] = { QUICK_KERNEL, SSE2_KERNEL, AVX2_KERNEL };
+    size_t i;
+
+    srand(1);
+
+    for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i) {
+        printf("%s kernel: ", names[i]);
+
+        if (set_search_kernel(kernels[i])) {
+            printf("Not available\n");
+            continue;
+        }
+
+        if (test_kernel())
+            debug(return 1);
+
+        printf("OK\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2026 Logan Ryan McLintock. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <debug.h>
+#include <regex.h>
+
+static int search(const char *pattern, const char *s1, const char *s2)
+{
+    /* Prints where the first match in s1 followed by s2 starts. */
+    Regex re;
+    size_t m;
+
+    if ((re = init_regex(pattern, strlen(pattern))) == NULL)
+        debug(return 1);
+
+    printf("%s: ", pattern);
+
+    if (regex_search(re, s1, strlen(s1), s2, strlen(s2), 0, &m))
+        printf("No match\n");
+    else
+        printf("%lu\n", (unsigned long) m);
+
+    free_regex(re);
+    return 0;
+}
+
+int main(void)
+{
+    const char *s1 = "12:00 status=OK\n12:01 status=FA";
+    const char *s2 = "IL code=42\n12:02 status=OK\n";
+
+    if (search("status=FAIL", s1, s2))
+        debug(return 1);
+
+    if (search("code=[0-9]+", s1, s2))
+        debug(return 1);
+
+    if (search("^12:0[12] status=(OK|FAIL)$", s1, s2))
+        debug(return 1);
+
+    if (search("\\d+:\\d+ .*=FAIL\\s", s1, s2))
+        debug(return 1);
+
+    if (search("status=WARN", s1, s2))
+        debug(return 1);
+
+    if (init_regex("(unmatched", 10) != NULL)
+        debug(return 1);
+
+    printf("(unmatched: Invalid pattern\n");
+
+    return 0;
+}